@@ -0,0 +1,250 @@
+#ifndef CONCURRENT_STATISTIC_RB_TREE
+#define CONCURRENT_STATISTIC_RB_TREE
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "persistent_statistic_rb_tree.h"
+
+// Single writer / multiple readers front end for PersistentOrderStatisticTree.
+//
+// The writer updates its own version by path copying and publishes every new root with
+// a release store. A published version is never modified again, so readers take no lock
+// and walk it with plain loads once they loaded the root. A replaced root is
+// retired into epoch lists and its reference dropped only when no reader that could
+// still see it is active, which frees just the nodes no newer version shares.
+//
+// A reader announces itself in one of a fixed set of epoch records, each on its own
+// cache lines, picked by a per thread hint so readers do not write to shared lines.
+template< class K, class V, class Comparer = std::less< K > >
+class ConcurrentOrderStatisticTree {
+
+    typedef PersistentOrderStatisticTree< K, V, Comparer > Tree;
+    typedef typename Tree::Node Node;
+    typedef typename Tree::const_iterator const_iterator;
+
+    enum { Epochs = 3 };
+
+    // 0 while free, otherwise epoch << 1 | 1 of the reader holding it. Padded to two
+    // lines, so the states of neighbour records never share one whatever the alignment.
+    struct Record {
+        Record() : state{ 0 } { }
+
+        std::atomic< unsigned > state;
+        char pad[ 128 - sizeof( std::atomic< unsigned > ) ];
+    };
+
+    class ReadGuard {
+        Record* record;
+    public:
+        explicit ReadGuard( const ConcurrentOrderStatisticTree& t );
+        ~ReadGuard() { record->state.store( 0, std::memory_order_release ); }
+    };
+
+    void publish();
+
+public:
+    typedef K KeyType;
+    typedef V ValueType;
+
+    // readers bounds the records, i.e. the readers inside a query at the same time before
+    // further ones wait, 0 stands for twice the hardware threads
+    explicit ConcurrentOrderStatisticTree( const Comparer& comparer = Comparer(), int readers = 0 );
+    ~ConcurrentOrderStatisticTree();
+
+    ConcurrentOrderStatisticTree( const ConcurrentOrderStatisticTree& ) = delete;
+    ConcurrentOrderStatisticTree& operator = ( const ConcurrentOrderStatisticTree& ) = delete;
+
+    // writer side, calls are serialized by the writer lock
+    void insertMulti( const K& key, const V& val );
+    bool removeOne( const K& key );
+    void clear();
+
+    // reader side, lock free
+    bool find( const K& key, V* val = nullptr ) const;
+    bool getNth( int order, K* key, V* val = nullptr ) const;
+    int countLess( const K& key ) const;
+    int size() const;
+    int scan( int order, int count, std::vector< std::pair< K, V > >& out ) const;
+
+private:
+    Tree tree_;
+    Comparer lessThan_;
+
+    std::mutex writer_;
+    std::atomic< Node* > published_;
+
+    std::atomic< unsigned > epoch_;
+    mutable std::vector< Record > records_;
+    std::vector< Node* > retired_[ Epochs ];
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template< class K, class V, class C >
+ConcurrentOrderStatisticTree< K, V, C >::ReadGuard::ReadGuard(
+        const ConcurrentOrderStatisticTree& t )
+{
+    // the claim and the following root load order against the root exchange and record scan
+    // in publish, so either the writer sees this reader or the reader sees the new root.
+    // A thread keeps probing from where it last found a free record.
+    static thread_local size_t hint = std::hash< std::thread::id >()( std::this_thread::get_id() );
+
+    size_t count = t.records_.size();
+    for( size_t probe = 0; ; ++probe ) {
+        if( probe == count ) {
+            std::this_thread::yield();
+            probe = 0;
+        }
+
+        record = &t.records_[ ( hint + probe ) % count ];
+        unsigned free = 0;
+        if( record->state.load( std::memory_order_relaxed ) == 0 &&
+            record->state.compare_exchange_strong( free, t.epoch_.load() << 1 | 1 ) ) {
+            hint += probe;
+            break;
+        }
+    }
+}
+
+template< class K, class V, class C >
+ConcurrentOrderStatisticTree< K, V, C >::ConcurrentOrderStatisticTree( const C& comparer,
+                                                                       int readers )
+    : tree_( comparer ), lessThan_( comparer ), published_{ nullptr }, epoch_{ 0 }
+    , records_( readers > 0 ? readers : 2 * std::max( 1u, std::thread::hardware_concurrency() ) )
+{ }
+
+template< class K, class V, class C >
+ConcurrentOrderStatisticTree< K, V, C >::~ConcurrentOrderStatisticTree()
+{
+    Tree::release( published_.load() );
+    for( int i = 0; i < Epochs; ++i ) {
+        for( Node* root : retired_[ i ] )
+            Tree::release( root );
+    }
+}
+
+// makes the writer's version visible, the published root holds a reference, so the
+// writer copies every node of it before changing anything
+template< class K, class V, class C >
+void ConcurrentOrderStatisticTree< K, V, C >::publish()
+{
+    Node* old = published_.exchange( Tree::retain( tree_.root() ) );
+
+    unsigned e = epoch_.load( std::memory_order_relaxed );
+    retired_[ e % Epochs ].push_back( old );
+
+    // every active reader entered the current epoch, so nothing retired two epochs ago
+    // is reachable any more
+    unsigned current = e << 1 | 1;
+    for( const Record& record : records_ ) {
+        unsigned state = record.state.load();
+        if( state != 0 && state != current )
+            return;
+    }
+
+    ++e;
+    epoch_.store( e );
+
+    std::vector< Node* >& reclaim = retired_[ e % Epochs ];
+    for( Node* root : reclaim )
+        Tree::release( root );
+    reclaim.clear();
+}
+
+template< class K, class V, class C >
+void ConcurrentOrderStatisticTree< K, V, C >::insertMulti( const K& key, const V& val )
+{
+    std::lock_guard< std::mutex > lock( writer_ );
+
+    tree_.insertMulti( key, val );
+    publish();
+}
+
+template< class K, class V, class C >
+bool ConcurrentOrderStatisticTree< K, V, C >::removeOne( const K& key )
+{
+    std::lock_guard< std::mutex > lock( writer_ );
+
+    if( !tree_.removeOne( key ) )
+        return false;
+
+    publish();
+    return true;
+}
+
+template< class K, class V, class C >
+void ConcurrentOrderStatisticTree< K, V, C >::clear()
+{
+    std::lock_guard< std::mutex > lock( writer_ );
+
+    tree_.clear();
+    publish();
+}
+
+template< class K, class V, class C >
+bool ConcurrentOrderStatisticTree< K, V, C >::find( const K& key, V* val ) const
+{
+    ReadGuard guard( *this );
+
+    const Node* n = Tree::findNode( published_.load(), key, lessThan_ );
+    if( !n )
+        return false;
+
+    if( val )
+        *val = n->val;
+    return true;
+}
+
+template< class K, class V, class C >
+bool ConcurrentOrderStatisticTree< K, V, C >::getNth( int order, K* key, V* val ) const
+{
+    ReadGuard guard( *this );
+
+    const Node* n = Tree::nthNode( published_.load(), order );
+    if( !n )
+        return false;
+
+    if( key )
+        *key = n->key;
+    if( val )
+        *val = n->val;
+    return true;
+}
+
+template< class K, class V, class C >
+int ConcurrentOrderStatisticTree< K, V, C >::countLess( const K& key ) const
+{
+    ReadGuard guard( *this );
+
+    return Tree::countLess( published_.load(), key, lessThan_ );
+}
+
+template< class K, class V, class C >
+int ConcurrentOrderStatisticTree< K, V, C >::size() const
+{
+    ReadGuard guard( *this );
+
+    return Tree::subtreeSize( published_.load() );
+}
+
+template< class K, class V, class C >
+int ConcurrentOrderStatisticTree< K, V, C >::scan(
+        int order, int count, std::vector< std::pair< K, V > >& out ) const
+{
+    ReadGuard guard( *this );
+
+    int scanned = 0;
+    const_iterator end;
+    for( const_iterator i = Tree::nth( published_.load(), order );
+         scanned < count && i != end; ++i, ++scanned )
+        out.push_back( std::make_pair( i.key(), i.value() ) );
+    return scanned;
+}
+
+#endif // CONCURRENT_STATISTIC_RB_TREE
@@ -0,0 +1,462 @@
+#ifndef DENSE_INT_STATISTIC_TREE
+#define DENSE_INT_STATISTIC_TREE
+
+#include <assert.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iterator>
+#include <vector>
+
+#if defined( __BMI2__ )
+#include <immintrin.h>
+#endif
+
+// Order statistic multimap over int keys of a known universe [0, universe).
+//
+// Presence of a key is one bit, entries per 64 key word are counted in a Fenwick tree,
+// so rank and select cost O(log(universe / 64)) plus one word. Inside a word rank is a
+// popcount and select a pdep, unless the word holds a duplicated key, then its keys are
+// walked. Values of keys held once share one pooled array per word ordered by key, so a
+// value's offset is a popcount. A duplicated key moves its values, ordered by insertion, to
+// an overflow bucket of its own, so no update shifts more than one word's pool and updates
+// cost O(log(universe / 64) + 64) however many copies a key has.
+template< class V >
+class DenseIntOrderStatisticTree {
+
+    enum { WordBits = 64 };
+
+    static int select64( uint64_t word, int rank );
+
+    int countInWord( int w, int bit ) const;
+    void selectInWord( int w, int rank, int* key, int* index ) const;
+    int nextPresent( int key ) const;
+    int prevPresent( int key ) const;
+
+    int prefix( int words ) const;
+    void add( int w, int delta );
+    void removeBucket( int key );
+
+    inline bool present( int key ) const
+        { return ( present_[ key / WordBits ] >> ( key % WordBits ) ) & 1; }
+    inline bool multi( int key ) const
+        { return ( multi_[ key / WordBits ] >> ( key % WordBits ) ) & 1; }
+    inline int count( int key ) const
+    {
+        if( !present( key ) )
+            return 0;
+        return multi( key ) ? static_cast< int >( overflow_[ bucket_[ key ] ].size() ) : 1;
+    }
+
+    // offset of a key held once in its word's pool, i.e. keys held once below it
+    inline int poolOffset( int key ) const
+    {
+        int w = key / WordBits;
+        uint64_t below = ( uint64_t( 1 ) << ( key % WordBits ) ) - 1;
+        return __builtin_popcountll( present_[ w ] & ~multi_[ w ] & below );
+    }
+    inline V& valueAt( int key, int index )
+    {
+        return multi( key ) ? overflow_[ bucket_[ key ] ][ index ]
+                            : values_[ key / WordBits ][ poolOffset( key ) ];
+    }
+
+public:
+    typedef int KeyType;
+    typedef V ValueType;
+
+    class iterator
+    {
+        friend class DenseIntOrderStatisticTree;
+
+        DenseIntOrderStatisticTree* t;
+        int k;
+        int index;
+        int o;
+
+        inline iterator( DenseIntOrderStatisticTree* t, int k, int index, int o )
+            : t{ t }, k{ k }, index{ index }, o{ o } { }
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::size_t difference_type;
+        typedef V  value_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        inline iterator() : t{ nullptr }, k{ 0 }, index{ 0 }, o{ 0 } { }
+
+        inline int key() const { return k; }
+        inline V& value() const { return t->valueAt( k, index ); }
+        inline int order() const { return o; }
+
+        inline V& operator * () const { return value(); }
+        inline V* operator -> () const { return &value(); }
+        inline bool operator == (iterator i) const { return o == i.o && t == i.t; }
+        inline bool operator != (iterator i) const { return !( *this == i ); }
+
+        inline iterator &operator ++ ()
+        {
+            if( ++index == t->count( k ) ) {
+                k = t->nextPresent( k + 1 );
+                index = 0;
+            }
+            ++o;
+            return *this;
+        }
+        inline iterator operator ++ (int)
+            { iterator r = *this; ++*this; return r; }
+
+        inline iterator &operator -- ()
+        {
+            if( index-- == 0 ) {
+                k = t->prevPresent( k - 1 );
+                index = t->count( k ) - 1;
+            }
+            --o;
+            return *this;
+        }
+        inline iterator operator -- (int)
+            { iterator r = *this; --*this; return r; }
+    };
+
+    explicit DenseIntOrderStatisticTree( int universe );
+
+    iterator begin() { return iterator{ this, nextPresent( 0 ), 0, 0 }; }
+    iterator end() { return iterator{ this, universe_, 0, size_ }; }
+
+    iterator insertMulti( int key, const V& val );
+    iterator find( int key );
+
+    bool removeOne( int key );
+    int removeMulti( int key );
+
+    iterator getNth( int order );
+    int countLess( int key ) const;
+
+    inline int size() const { return size_; }
+    inline int universe() const { return universe_; }
+
+    void clear();
+
+    bool valid() const;
+
+private:
+    int universe_;
+    int size_;
+    int words_;
+
+    std::vector< uint64_t > present_;
+    std::vector< uint64_t > multi_;
+    std::vector< int > fenwick_;
+
+    // pooled values of keys held once, per word
+    std::vector< std::vector< V > > values_;
+
+    // values of duplicated keys, bucket_ only holds for keys flagged in multi_
+    std::vector< int > bucket_;
+    std::vector< std::vector< V > > overflow_;
+    std::vector< int > overflowKey_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template< class V >
+DenseIntOrderStatisticTree< V >::DenseIntOrderStatisticTree( int universe )
+    : universe_{ universe }, size_{ 0 }, words_{ ( universe + WordBits - 1 ) / WordBits }
+    , present_( words_ ), multi_( words_ ), fenwick_( words_ + 1 ), values_( words_ )
+    , bucket_( universe )
+{ }
+
+template< class V >
+inline int DenseIntOrderStatisticTree< V >::select64( uint64_t word, int rank )
+{
+#if defined( __BMI2__ )
+    return __builtin_ctzll( _pdep_u64( uint64_t( 1 ) << rank, word ) );
+#else
+    for( ; rank > 0; --rank )
+        word &= word - 1;
+    return __builtin_ctzll( word );
+#endif
+}
+
+// entries with keys below bit inside word w
+template< class V >
+int DenseIntOrderStatisticTree< V >::countInWord( int w, int bit ) const
+{
+    uint64_t below = present_[ w ] & ( ( uint64_t( 1 ) << bit ) - 1 );
+    int count = __builtin_popcountll( below & ~multi_[ w ] );
+    for( below &= multi_[ w ]; below; below &= below - 1 )
+        count += this->count( w * WordBits + __builtin_ctzll( below ) );
+    return count;
+}
+
+template< class V >
+void DenseIntOrderStatisticTree< V >::selectInWord( int w, int rank, int* key, int* index ) const
+{
+    uint64_t word = present_[ w ];
+    if( !multi_[ w ] ) {
+        *key = w * WordBits + select64( word, rank );
+        *index = 0;
+        return;
+    }
+
+    for( ; word; word &= word - 1 ) {
+        int k = w * WordBits + __builtin_ctzll( word );
+        int c = count( k );
+        if( rank < c ) {
+            *key = k;
+            *index = rank;
+            return;
+        }
+        rank -= c;
+    }
+}
+
+// first present key not below key, universe if none
+template< class V >
+int DenseIntOrderStatisticTree< V >::nextPresent( int key ) const
+{
+    if( key >= universe_ )
+        return universe_;
+
+    int w = key / WordBits;
+    uint64_t word = present_[ w ] & ( ~uint64_t( 0 ) << ( key % WordBits ) );
+    while( !word ) {
+        if( ++w == words_ )
+            return universe_;
+        word = present_[ w ];
+    }
+    return w * WordBits + __builtin_ctzll( word );
+}
+
+// last present key not above key, -1 if none
+template< class V >
+int DenseIntOrderStatisticTree< V >::prevPresent( int key ) const
+{
+    if( key < 0 )
+        return -1;
+
+    int w = key / WordBits;
+    uint64_t word = present_[ w ] & ( ~uint64_t( 0 ) >> ( WordBits - 1 - key % WordBits ) );
+    while( !word ) {
+        if( w-- == 0 )
+            return -1;
+        word = present_[ w ];
+    }
+    return w * WordBits + WordBits - 1 - __builtin_clzll( word );
+}
+
+// entries in the first words words
+template< class V >
+int DenseIntOrderStatisticTree< V >::prefix( int words ) const
+{
+    int sum = 0;
+    for( int i = words; i > 0; i -= i & -i )
+        sum += fenwick_[ i ];
+    return sum;
+}
+
+template< class V >
+void DenseIntOrderStatisticTree< V >::add( int w, int delta )
+{
+    for( int i = w + 1; i <= words_; i += i & -i )
+        fenwick_[ i ] += delta;
+}
+
+template< class V >
+void DenseIntOrderStatisticTree< V >::removeBucket( int key )
+{
+    // keep buckets dense, the last one takes the freed slot
+    int slot = bucket_[ key ];
+    if( slot != static_cast< int >( overflow_.size() ) - 1 ) {
+        overflow_[ slot ].swap( overflow_.back() );
+        overflowKey_[ slot ] = overflowKey_.back();
+        bucket_[ overflowKey_[ slot ] ] = slot;
+    }
+    overflow_.pop_back();
+    overflowKey_.pop_back();
+}
+
+template< class V >
+typename DenseIntOrderStatisticTree< V >::iterator
+DenseIntOrderStatisticTree< V >::insertMulti( int key, const V& val )
+{
+    assert( key >= 0 && key < universe_ );
+
+    int w = key / WordBits;
+    uint64_t bit = uint64_t( 1 ) << ( key % WordBits );
+    std::vector< V >& pool = values_[ w ];
+
+    // after the entries already held for key
+    int index = count( key );
+    if( index == 0 ) {
+        pool.insert( pool.begin() + poolOffset( key ), val );
+        present_[ w ] |= bit;
+    }
+    else if( index == 1 ) {
+        // the second copy moves the key out of the pool
+        int offset = poolOffset( key );
+        bucket_[ key ] = static_cast< int >( overflow_.size() );
+        overflow_.emplace_back();
+        overflow_.back().push_back( pool[ offset ] );
+        overflow_.back().push_back( val );
+        overflowKey_.push_back( key );
+        pool.erase( pool.begin() + offset );
+        multi_[ w ] |= bit;
+    }
+    else
+        overflow_[ bucket_[ key ] ].push_back( val );
+
+    add( w, 1 );
+    ++size_;
+
+    return iterator{ this, key, index, prefix( w ) + countInWord( w, key % WordBits ) + index };
+}
+
+template< class V >
+typename DenseIntOrderStatisticTree< V >::iterator
+DenseIntOrderStatisticTree< V >::find( int key )
+{
+    if( key < 0 || key >= universe_ || !present( key ) )
+        return end();
+
+    return iterator{ this, key, 0, countLess( key ) };
+}
+
+template< class V >
+bool DenseIntOrderStatisticTree< V >::removeOne( int key )
+{
+    if( key < 0 || key >= universe_ || !present( key ) )
+        return false;
+
+    int w = key / WordBits;
+    uint64_t bit = uint64_t( 1 ) << ( key % WordBits );
+    std::vector< V >& pool = values_[ w ];
+
+    // the latest entry of key goes, the last but one moves back into the pool
+    if( !multi( key ) ) {
+        pool.erase( pool.begin() + poolOffset( key ) );
+        present_[ w ] &= ~bit;
+    }
+    else {
+        std::vector< V >& bucket = overflow_[ bucket_[ key ] ];
+        bucket.pop_back();
+        if( bucket.size() == 1 ) {
+            multi_[ w ] &= ~bit;
+            pool.insert( pool.begin() + poolOffset( key ), bucket.front() );
+            removeBucket( key );
+        }
+    }
+
+    add( w, -1 );
+    --size_;
+
+    return true;
+}
+
+template< class V >
+int DenseIntOrderStatisticTree< V >::removeMulti( int key )
+{
+    int removed = key < 0 || key >= universe_ ? 0 : count( key );
+    if( removed == 0 )
+        return 0;
+
+    int w = key / WordBits;
+    uint64_t bit = uint64_t( 1 ) << ( key % WordBits );
+    if( removed > 1 ) {
+        removeBucket( key );
+        multi_[ w ] &= ~bit;
+    }
+    else
+        values_[ w ].erase( values_[ w ].begin() + poolOffset( key ) );
+    present_[ w ] &= ~bit;
+
+    add( w, -removed );
+    size_ -= removed;
+
+    return removed;
+}
+
+template< class V >
+typename DenseIntOrderStatisticTree< V >::iterator
+DenseIntOrderStatisticTree< V >::getNth( int order )
+{
+    if( order < 0 || order >= size_ )
+        return end();
+
+    // Fenwick descent to the word holding the order
+    int w = 0;
+    int rest = order;
+    int step = 1;
+    while( step * 2 <= words_ )
+        step *= 2;
+    for( ; step; step /= 2 ) {
+        if( w + step <= words_ && fenwick_[ w + step ] <= rest ) {
+            w += step;
+            rest -= fenwick_[ w ];
+        }
+    }
+
+    int key = universe_;
+    int index = 0;
+    selectInWord( w, rest, &key, &index );
+    return iterator{ this, key, index, order };
+}
+
+template< class V >
+int DenseIntOrderStatisticTree< V >::countLess( int key ) const
+{
+    if( key <= 0 )
+        return 0;
+    if( key >= universe_ )
+        return size_;
+
+    int w = key / WordBits;
+    return prefix( w ) + countInWord( w, key % WordBits );
+}
+
+template< class V >
+void DenseIntOrderStatisticTree< V >::clear()
+{
+    std::fill( present_.begin(), present_.end(), 0 );
+    std::fill( multi_.begin(), multi_.end(), 0 );
+    std::fill( fenwick_.begin(), fenwick_.end(), 0 );
+    values_.assign( words_, std::vector< V >() );
+    overflow_.clear();
+    overflowKey_.clear();
+    size_ = 0;
+}
+
+#if CHECK_VALID == 0
+
+template< class V >
+bool DenseIntOrderStatisticTree< V >::valid() const
+{
+    int total = 0;
+    int buckets = 0;
+    for( int w = 0; w < words_; ++w ) {
+        assert( ( multi_[ w ] & ~present_[ w ] ) == 0 );
+        int inWord = 0;
+        for( uint64_t word = present_[ w ]; word; word &= word - 1 ) {
+            int key = w * WordBits + __builtin_ctzll( word );
+            if( multi( key ) ) {
+                assert( overflowKey_[ bucket_[ key ] ] == key && count( key ) > 1 );
+                ++buckets;
+            }
+            inWord += count( key );
+        }
+        assert( prefix( w + 1 ) - prefix( w ) == inWord );
+        assert( static_cast< int >( values_[ w ].size() )
+                == __builtin_popcountll( present_[ w ] & ~multi_[ w ] ) );
+        total += inWord;
+    }
+
+    assert( total == size_ );
+    assert( buckets == static_cast< int >( overflow_.size() ) );
+    assert( overflow_.size() == overflowKey_.size() );
+    return true;
+}
+#endif
+
+
+#endif // DENSE_INT_STATISTIC_TREE
@@ -1,6 +1,13 @@
 #include <iostream>
+#include <map>
+#include <thread>
 
 #include "statistic_rb_tree.h"
+#include "concurrent_statistic_rb_tree.h"
+#include "persistent_statistic_rb_tree.h"
+#include "dense_int_statistic_tree.h"
+#include "statistic_rb_set.h"
+#include "statistic_rb_sequence.h"
 
 #include <time.h>
 
@@ -11,6 +18,19 @@ void test_const( const T& t ) {
     }
 }
 
+// entries in order, equal keys in insertion order, as a std::multimap keeps them
+template< class Tree >
+void check_model( Tree& t, const std::multimap< int, int >& model ) {
+    assert( t.size() == static_cast< int >( model.size() ) && t.valid() );
+    auto i = t.begin();
+    int order = 0;
+    for( auto m = model.begin(); m != model.end(); ++m, ++i, ++order ) {
+        assert( i.key() == m->first && i.value() == m->second );
+        assert( i.order() == order && t.getNth( order ) == i );
+    }
+    assert( i == t.end() );
+}
+
 int main() {
 
     OrderStatisticTree< int, int, std::greater< int > > t;
@@ -116,6 +136,11 @@ int main() {
 
     std::cout << repeat_count << " nodes founds in " << clock() - count << " clocks" << std::endl;
 
+    for( int i = nth; i < size - nth; i += 997 ) {
+        assert( ( t.getNth( i ) + nth ).order() == i + nth );
+        assert( ( t.getNth( i ) - nth ).order() == i - nth );
+    }
+
     std::cout << "all tests passed" << std::endl << std::endl;
 
     t.clear();
@@ -124,6 +149,447 @@ int main() {
     t.insertMulti( 2, 1 );
     assert( t.erase( t.find( 2 ) ).key() == 1 );
     assert( t.size() == 1 );
+    assert( t.countLess( 2 ) == 0 && t.countLess( 0 ) == 1 );
+
+    std::cout << "begin set algebra tests" << std::endl;
+
+    t.clear();
+    for( int i = 0; i < size; ++i )
+        t.insertMulti( 2 * i, i );
+
+    OrderStatisticTree< int, int, std::greater< int > > fresh;
+    int f_size = 5000;
+    for( int i = 0; i < f_size; ++i )
+        fresh.insertMulti( rand() % ( 2 * size ), -i );
+
+    OrderStatisticTree< int, int, std::greater< int > > keys;
+    for( auto i = fresh.begin(); i != fresh.end(); ++i )
+        keys.insertMulti( i.key(), 0 );
+
+    count = clock();
+
+    t.merge( fresh );
+
+    std::cout << f_size << " nodes merged in " << clock() - count << " clocks" << std::endl;
+
+    assert( t.size() == size + f_size && fresh.size() == 0 );
+    assert( t.valid() );
+    it = t.begin();
+    for( int i = 0; i < t.size(); ++i, ++it ) {
+        assert( it.order() == i );
+    }
+
+    count = clock();
+
+    t.difference( keys );
+
+    std::cout << keys.size() << " keys differenced in " << clock() - count << " clocks" << std::endl;
+
+    assert( t.valid() );
+    for( auto i = keys.begin(); i != keys.end(); ++i )
+        assert( t.find( i.key() ) == t.end() );
+
+    int d_size = t.size();
+    t.intersect( keys );
+    assert( t.size() == 0 && t.valid() );
+
+    for( int i = 0; i < 100; ++i )
+        t.insertMulti( i, i );
+    for( int i = 50; i < 150; ++i )
+        fresh.insertMulti( i, -i );
+
+    t.unionWith( fresh );
+    assert( t.size() == 150 && fresh.size() == 0 && t.valid() );
+    assert( *t.find( 75 ) == 75 && *t.find( 125 ) == -125 );
+
+    // overlapping random inputs with duplicates on both sides
+    for( int round = 0; round < 3; ++round ) {
+        std::vector< std::pair< int, int > > left, right;
+        for( int i = 0; i < 3000; ++i )
+            left.push_back( std::make_pair( rand() % 2000, i ) );
+        for( int i = 0; i < 1000 + 1000 * round; ++i )
+            right.push_back( std::make_pair( rand() % 3000, -i - 1 ) );
+
+        std::multimap< int, int > inLeft( left.begin(), left.end() );
+        std::multimap< int, int > inRight( right.begin(), right.end() );
+
+        OrderStatisticTree< int, int > a, b;
+        std::multimap< int, int > model;
+
+        for( auto& e : left ) a.insertMulti( e.first, e.second );
+        for( auto& e : right ) b.insertMulti( e.first, e.second );
+        model = inLeft;
+        model.insert( right.begin(), right.end() );
+        a.merge( b );
+        check_model( a, model );
+        a.clear();
+
+        for( auto& e : left ) a.insertMulti( e.first, e.second );
+        for( auto& e : right ) b.insertMulti( e.first, e.second );
+        model = inLeft;
+        for( auto& e : right )
+            if( !inLeft.count( e.first ) ) model.insert( e );
+        a.unionWith( b );
+        check_model( a, model );
+        a.clear();
+
+        for( auto& e : left ) a.insertMulti( e.first, e.second );
+        for( auto& e : right ) b.insertMulti( e.first, e.second );
+        model.clear();
+        for( auto& e : left )
+            if( inRight.count( e.first ) ) model.insert( e );
+        a.intersect( b );
+        check_model( a, model );
+        check_model( b, inRight );
+        a.clear();
+
+        for( auto& e : left ) a.insertMulti( e.first, e.second );
+        model.clear();
+        for( auto& e : left )
+            if( !inRight.count( e.first ) ) model.insert( e );
+        a.difference( b );
+        check_model( a, model );
+        a.clear();
+        b.clear();
+    }
+
+    std::cout << size + f_size - d_size << " nodes removed by set algebra" << std::endl;
+    std::cout << "all set algebra tests passed" << std::endl << std::endl;
+
+    std::cout << "begin parallel tests" << std::endl;
+
+    std::vector< std::pair< int, int > > items;
+    for( int i = 0; i < size; ++i )
+        items.push_back( std::make_pair( rand() % size, i ) );
+
+    std::vector< std::pair< int, int > > input( items );
+
+    count = clock();
+
+    t.bulkBuild( std::move( input ) );
+
+    std::cout << size << " nodes built in " << clock() - count << " clocks" << std::endl;
+
+    assert( t.size() == size );
+    assert( t.valid() );
+
+    std::stable_sort( items.begin(), items.end(),
+                      []( const std::pair< int, int >& a, const std::pair< int, int >& b )
+                        { return a.first > b.first; } );
+    it = t.begin();
+    for( int i = 0; i < size; ++i, ++it ) {
+        assert( it.key() == items[ i ].first && it.value() == items[ i ].second );
+        assert( it.order() == i );
+    }
+
+    count = clock();
+
+    std::vector< int > visited( size, 0 );
+    t.parallelForEach( 0, size, [&]( const int&, int& val ) { ++visited[ val ]; } );
+
+    long long sum = t.parallelReduce( size / 4, size, 0LL,
+                                      []( const int& key, int& ) { return ( long long )key; },
+                                      []( long long a, long long b ) { return a + b; } );
+
+    std::cout << size << " nodes visited in " << clock() - count << " clocks" << std::endl;
+
+    assert( std::count( visited.begin(), visited.end(), 1 ) == size );
+    long long expected = 0;
+    for( int i = size / 4; i < size; ++i )
+        expected += items[ i ].first;
+    assert( sum == expected );
+
+    // orders outside the tree are clamped away
+    assert( t.parallelReduce( -size, 2 * size, 0,
+                              []( const int&, int& ) { return 1; },
+                              []( int a, int b ) { return a + b; } ) == size );
+
+    std::cout << "all parallel tests passed" << std::endl << std::endl;
+
+    std::cout << "begin concurrent tests" << std::endl;
+
+    ConcurrentOrderStatisticTree< int, int > ct;
+
+    count = clock();
+
+    std::atomic< bool > writing{ true };
+    std::vector< std::thread > readers;
+    for( int r = 0; r < 3; ++r ) {
+        readers.emplace_back( [&]() {
+            std::vector< std::pair< int, int > > window;
+            while( writing ) {
+                int n = ct.size();
+                int key, val;
+                if( n > 0 && ct.getNth( n / 2, &key, &val ) )
+                    assert( key == val && ct.countLess( key ) <= key );
+
+                window.clear();
+                ct.scan( 0, 16, window );
+                for( size_t i = 1; i < window.size(); ++i )
+                    assert( window[ i - 1 ].first < window[ i ].first );
+            }
+        } );
+    }
+
+    int c_size = 1e5;
+    for( int i = 0; i < c_size; ++i )
+        ct.insertMulti( i, i );
+    for( int i = 0; i < c_size; i += 2 )
+        ct.removeOne( i );
+
+    writing = false;
+    for( auto& reader : readers )
+        reader.join();
+
+    std::cout << c_size << " nodes inserted and " << c_size / 2 << " removed under 3 readers in "
+              << clock() - count << " clocks" << std::endl;
+
+    assert( ct.size() == c_size / 2 );
+    for( int i = 0; i < c_size / 2; ++i ) {
+        int key, val;
+        assert( ct.getNth( i, &key, &val ) && key == 2 * i + 1 && val == key );
+        assert( ct.countLess( key ) == i );
+    }
+
+    std::cout << "all concurrent tests passed" << std::endl << std::endl;
+
+    std::cout << "begin persistent tests" << std::endl;
+
+    PersistentOrderStatisticTree< int, int > pt;
+
+    count = clock();
+
+    int p_size = 1e5;
+    for( int i = 0; i < p_size; ++i )
+        pt.insertMulti( rand() % p_size, i );
+
+    assert( pt.size() == p_size );
+    assert( pt.valid() );
+
+    std::vector< std::pair< int, int > > before;
+    for( auto i = pt.begin(); i != pt.end(); ++i )
+        before.push_back( std::make_pair( i.key(), i.value() ) );
+
+    auto snapshot = pt.snapshot();
+
+    for( int i = 0; i < p_size; ++i ) {
+        if( i % 2 )     pt.insertMulti( rand() % p_size, -i );
+        else            pt.removeOne( rand() % p_size );
+    }
+
+    std::cout << p_size << " updates over snapshot in " << clock() - count << " clocks" << std::endl;
+
+    assert( pt.valid() );
+    assert( snapshot.size() == p_size );
+
+    auto si = snapshot.begin();
+    for( int i = 0; i < p_size; ++i, ++si ) {
+        assert( si.key() == before[ i ].first && si.value() == before[ i ].second );
+        assert( si.order() == i );
+        assert( snapshot.getNth( i ).key() == before[ i ].first );
+    }
+    assert( si == snapshot.end() );
+
+    auto pi = pt.begin();
+    for( int i = 0; i < pt.size(); ++i, ++pi ) {
+        assert( pt.getNth( i ) == pi );
+        assert( pt.countLess( pi.key() ) <= i );
+    }
+
+    snapshot = pt.snapshot();
+    int middle = pt.size() / 2;
+    pt.erase( pt.getNth( middle ) );
+    assert( pt.size() == snapshot.size() - 1 && pt.valid() );
+    assert( pt.getNth( middle ).value() == snapshot.getNth( middle + 1 ).value() );
+
+    pt.clear();
+    assert( pt.size() == 0 && pt.valid() );
+    int first = snapshot.getNth( 0 ).key();
+    assert( snapshot.find( first ).key() == first );
+    assert( snapshot.countLess( first ) == 0 );
+
+    std::cout << "all persistent tests passed" << std::endl << std::endl;
+
+    std::cout << "begin dense tests" << std::endl;
+
+    DenseIntOrderStatisticTree< int > dt( size );
+
+    count = clock();
+
+    for( int i = 0; i < size; ++i )
+        dt.insertMulti( rand() % size, i );
+
+    std::cout << size << " dense nodes randomly inserted in "
+              << clock() - count << " clocks" << std::endl;
+
+    assert( dt.size() == size );
+    assert( dt.valid() );
+
+    count = clock();
+
+    for( int i = 0; i < size; ++i )
+        dt.removeOne( rand() % size );
+
+    std::cout << size - dt.size() << " dense nodes randomly removed in "
+              << clock() - count << " clocks" << std::endl;
+
+    assert( dt.valid() );
+
+    count = clock();
+
+    auto di = dt.begin();
+    for( int i = 0; i < dt.size(); ++i, ++di ) {
+        assert( dt.getNth( i ) == di && *dt.getNth( i ) == *di );
+        assert( di.order() == i );
+        assert( dt.countLess( di.key() ) <= i );
+    }
+    assert( di == dt.end() );
+
+    std::cout << dt.size() << " dense nodes order validated in "
+              << clock() - count << " clocks" << std::endl;
+
+    dt.clear();
+    for( int i = 0; i < size; ++i )
+        dt.insertMulti( 1, i );
+    assert( dt.getNth( size / 2 ).key() == 1 && *dt.getNth( size / 2 ) == size / 2 );
+    assert( dt.removeMulti( 1 ) == size && dt.size() == 0 && dt.valid() );
+
+    // copies of a low key in a populated word must not shift the word's other values
+    for( int i = 0; i < 64; ++i )
+        dt.insertMulti( i, i );
+
+    count = clock();
+
+    for( int i = 1; i <= size; ++i )
+        dt.insertMulti( 0, -i );
+    for( int i = 0; i < size / 2; ++i )
+        dt.removeOne( 0 );
+
+    std::cout << size << " copies of a low key inserted and " << size / 2 << " removed in "
+              << clock() - count << " clocks" << std::endl;
+
+    assert( dt.valid() && dt.size() == 64 + size - size / 2 );
+    assert( *dt.getNth( 0 ) == 0 && *dt.getNth( 1 ) == -1 );
+    assert( dt.countLess( 1 ) == 1 + size - size / 2 && *dt.find( 1 ) == 1 );
+    assert( dt.removeMulti( 0 ) == 1 + size - size / 2 && dt.valid() );
+    assert( dt.getNth( 0 ).key() == 1 && *dt.getNth( 62 ) == 63 );
+
+    std::cout << "all dense tests passed" << std::endl << std::endl;
+
+    std::cout << "begin multiset tests" << std::endl;
+
+    OrderStatisticMultiset< int, std::greater< int > > ms;
+
+    count = clock();
+
+    for( int i = 0; i < size; ++i )
+        ms.insert( 1 );
+
+    std::cout << size << " copies inserted in " << clock() - count << " clocks" << std::endl;
+
+    assert( ms.size() == size && ms.count( 1 ) == size );
+    assert( ms.valid() );
+    assert( ms.getNth( size / 2 ).order() == size / 2 );
+
+    for( int i = 0; i < size; ++i )
+        ms.insert( rand() % size );
+
+    assert( ms.size() == 2 * size );
+    assert( ms.valid() );
+
+    auto mi = ms.begin();
+    for( int i = 0; i < ms.size(); i += 1000 ) {
+        assert( ms.getNth( i ) == mi );
+        assert( mi.order() == i );
+        assert( ms.countLess( *mi ) <= i );
+        for( int j = 0; j < 1000; ++j )
+            ++mi;
+    }
+
+    count = clock();
+
+    for( int i = 0; i < size; ++i )
+        ms.removeOne( 1 );
+
+    std::cout << size << " copies removed in " << clock() - count << " clocks" << std::endl;
+
+    assert( ms.size() == size && ms.valid() );
+
+    OrderStatisticSet< int > st;
+    assert( st.insert( 3 ).second && !st.insert( 3 ).second && st.insert( 1 ).second );
+    assert( st.size() == 2 && st.getNth( 1 ).key() == 3 && st.countLess( 3 ) == 1 );
+
+    std::cout << "all multiset tests passed" << std::endl << std::endl;
+
+    std::cout << "begin sequence tests" << std::endl;
+
+    OrderStatisticSequence< int > sq;
+
+    count = clock();
+
+    std::vector< int > values( size );
+    for( int i = 0; i < size; ++i )
+        values[ i ] = i;
+    sq.insertRange( 0, values.begin(), values.end() );
+
+    std::cout << size << " elements inserted in range in " << clock() - count << " clocks" << std::endl;
+
+    assert( sq.size() == size && sq.valid() );
+
+    count = clock();
+
+    for( int i = 0; i < size; ++i )
+        sq.move( rand() % size, rand() % size );
+
+    std::cout << size << " elements moved in " << clock() - count << " clocks" << std::endl;
+
+    assert( sq.size() == size && sq.valid() );
+
+    std::vector< int > seen( size, 0 );
+    int qi = 0;
+    for( auto i = sq.begin(); i != sq.end(); ++i, ++qi ) {
+        assert( i.order() == qi && sq.at( qi ) == *i );
+        ++seen[ *i ];
+    }
+    assert( std::count( seen.begin(), seen.end(), 1 ) == size );
+
+    sq.clear();
+    sq.insertAt( 0, 2 );
+    sq.insertAt( 0, 0 );
+    sq.insertAt( 1, 1 );
+    sq.insertAt( 3, 3 );
+    sq.move( 0, 3 );
+    assert( sq.at( 0 ) == 1 && sq.at( 1 ) == 2 && sq.at( 2 ) == 3 && sq.at( 3 ) == 0 );
+    assert( *sq.eraseAt( 1 ) == 3 && sq.size() == 3 && sq.valid() );
+
+    // ranges joined at the end and inside a non-empty sequence, against a vector model
+    std::vector< int > model( 1, 7 );
+    sq.clear();
+    sq.insertAt( 0, 7 );
+    for( int round = 0; round < 200; ++round ) {
+        std::vector< int > range( 1 + rand() % 64 );
+        for( size_t i = 0; i < range.size(); ++i )
+            range[ i ] = rand();
+
+        int pos = round % 2 ? sq.size() : 1 + rand() % sq.size();
+        sq.insertRange( pos, range.begin(), range.end() );
+        model.insert( model.begin() + pos, range.begin(), range.end() );
+        assert( sq.size() == static_cast< int >( model.size() ) && sq.valid() );
+    }
+    for( size_t i = 0; i < model.size(); ++i )
+        assert( sq.at( i ) == model[ i ] );
+
+    for( int i = 0; i < 100; ++i ) {
+        assert( *sq.eraseAt( 0 ) == model[ 1 ] );
+        assert( sq.eraseAt( sq.size() - 1 ) == sq.end() );
+        model.erase( model.begin() );
+        model.pop_back();
+        assert( sq.size() == static_cast< int >( model.size() ) && sq.valid() );
+    }
+    for( size_t i = 0; i < model.size(); ++i )
+        assert( sq.at( i ) == model[ i ] );
+
+    std::cout << "all sequence tests passed" << std::endl;
 
     return 0;
 }
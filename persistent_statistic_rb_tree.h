@@ -0,0 +1,566 @@
+#ifndef PERSISTENT_STATISTIC_RB_TREE
+#define PERSISTENT_STATISTIC_RB_TREE
+
+#include <assert.h>
+#include <atomic>
+#include <iterator>
+#include <vector>
+
+#include "statistic_rb_tree.h"
+
+// Order statistic tree with O(1) immutable snapshots.
+//
+// Nodes carry no parent pointer and are reference counted, so a snapshot only takes
+// a reference on the root. Updates copy a node before touching it when it is shared
+// with a snapshot, i.e. only the O(log n) nodes on the modified path (subtree sizes
+// included) are duplicated. Balancing is left leaning red black, which only needs
+// the nodes on that path and their siblings.
+template< class K, class V, class C >
+class ConcurrentOrderStatisticTree;
+
+template< class K, class V, class Comparer = std::less< K > >
+class PersistentOrderStatisticTree {
+
+    template< class K2, class V2, class C2 >
+    friend class ConcurrentOrderStatisticTree;
+
+    struct Node {
+        Node( const K& key, const V& val )
+            : l{ nullptr }, r{ nullptr }, s{ 1 }, c{ RBNode::Red }, refs{ 1 }
+            , key{ key }, val{ val } { }
+
+        Node( const Node& o )
+            : l{ retain( o.l ) }, r{ retain( o.r ) }, s{ o.s }, c{ o.c }, refs{ 1 }
+            , key{ o.key }, val{ o.val } { }
+
+        Node* l;
+        Node* r;
+        int s;
+        RBNode::Color c;
+        std::atomic< int > refs;
+        K key;
+        V val;
+    };
+
+    static Node* retain( Node* n );
+    static void release( Node* n );
+    static Node* own( Node* n );
+
+    inline static int subtreeSize( const Node* n ) { return n ? n->s : 0; }
+    inline static bool isRed( const Node* n ) { return n && n->c == RBNode::Red; }
+
+    static Node* rotateLeft( Node* h );
+    static Node* rotateRight( Node* h );
+    static void flipColors( Node* h );
+    static Node* moveRedLeft( Node* h );
+    static Node* moveRedRight( Node* h );
+    static Node* balance( Node* h );
+    static Node* deleteMin( Node* h );
+
+    Node* insert( Node* h, Node* node );
+    static Node* remove( Node* h, int order );
+
+    int blackHeight( const Node* n ) const;
+
+public:
+    class const_iterator;
+
+private:
+    // queries on any version, shared by snapshots and the concurrent readers
+    static const_iterator first( const Node* root );
+    static const_iterator find( const Node* root, const K& key, const Comparer& lessThan );
+    static const_iterator nth( const Node* root, int order );
+    static int countLess( const Node* root, const K& key, const Comparer& lessThan );
+
+    // the same walks without an iterator, they allocate nothing
+    static const Node* findNode( const Node* root, const K& key, const Comparer& lessThan );
+    static const Node* nthNode( const Node* root, int order );
+
+    inline Node* root() const { return head_.root_; }
+
+public:
+    typedef K KeyType;
+    typedef V ValueType;
+
+    class const_iterator
+    {
+        friend class PersistentOrderStatisticTree;
+
+        // pending ancestors we went left from, current node on top
+        std::vector< const Node* > path;
+        int o;
+
+        void pushLeft( const Node* n )
+            { for( ; n; n = n->l ) path.push_back( n ); }
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef std::size_t difference_type;
+        typedef V  value_type;
+        typedef const V* pointer;
+        typedef const V& reference;
+
+        inline const_iterator() : o{ 0 } { }
+
+        inline const KeyType& key() const { return path.back()->key; }
+        inline const ValueType& value() const { return path.back()->val; }
+        inline int order() const { return o; }
+
+        inline const ValueType& operator * () const { return path.back()->val; }
+        inline const ValueType* operator -> () const { return &path.back()->val; }
+        inline bool operator == ( const const_iterator& other ) const
+            { return path.empty() ? other.path.empty()
+                                  : !other.path.empty() && path.back() == other.path.back(); }
+        inline bool operator != ( const const_iterator& other ) const
+            { return !( *this == other ); }
+
+        inline const_iterator &operator ++ ()
+        {
+            const Node* n = path.back();
+            path.pop_back();
+            pushLeft( n->r );
+            ++o;
+            return *this;
+        }
+        inline const_iterator operator ++ (int)
+            { const_iterator r = *this; ++*this; return r; }
+    };
+
+    // immutable point in time view, cheap to copy and safe to read from other threads
+    class Snapshot
+    {
+        friend class PersistentOrderStatisticTree;
+
+        Snapshot( Node* root, const Comparer& comparer )
+            : root_{ root }, lessThan_( comparer ) { }
+
+    public:
+        Snapshot( const Snapshot& o ) : root_{ retain( o.root_ ) }, lessThan_( o.lessThan_ ) { }
+        Snapshot& operator = ( const Snapshot& o )
+        {
+            Node* root = retain( o.root_ );
+            release( root_ );
+            root_ = root;
+            lessThan_ = o.lessThan_;
+            return *this;
+        }
+        ~Snapshot() { release( root_ ); }
+
+        const_iterator begin() const { return first( root_ ); }
+        const_iterator end() const { return const_iterator{}; }
+
+        const_iterator find( const K& key ) const
+            { return PersistentOrderStatisticTree::find( root_, key, lessThan_ ); }
+        const_iterator getNth( int order ) const { return nth( root_, order ); }
+        int countLess( const K& key ) const
+            { return PersistentOrderStatisticTree::countLess( root_, key, lessThan_ ); }
+
+        inline int size() const { return subtreeSize( root_ ); }
+
+    private:
+        Node* root_;
+        Comparer lessThan_;
+    };
+
+    explicit PersistentOrderStatisticTree( const Comparer& comparer = Comparer() )
+        : head_{ nullptr, comparer }
+    { }
+
+    PersistentOrderStatisticTree( const PersistentOrderStatisticTree& ) = delete;
+    PersistentOrderStatisticTree& operator = ( const PersistentOrderStatisticTree& ) = delete;
+
+    const_iterator begin() const { return head_.begin(); }
+    const_iterator end() const { return head_.end(); }
+
+    void insertMulti( const K& key, const V& val );
+    // i must come from this tree, not a snapshot, every iterator of it is invalidated
+    void erase( const_iterator i );
+    bool removeOne( const K& key );
+
+    const_iterator find( const K& key ) const { return head_.find( key ); }
+    const_iterator getNth( int order ) const { return head_.getNth( order ); }
+    int countLess( const K& key ) const { return head_.countLess( key ); }
+
+    inline int size() const { return head_.size(); }
+
+    Snapshot snapshot() const { return head_; }
+
+    void clear();
+
+    bool valid() const;
+
+private:
+    Snapshot head_;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template< class K, class V, class C >
+inline typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::retain( Node* n )
+{
+    if( n )
+        n->refs.fetch_add( 1, std::memory_order_relaxed );
+    return n;
+}
+
+template< class K, class V, class C >
+void PersistentOrderStatisticTree< K, V, C >::release( Node* n )
+{
+    if( n && n->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+        release( n->l );
+        release( n->r );
+        delete n;
+    }
+}
+
+// returns node which is safe to modify in place, copying it if a snapshot shares it
+template< class K, class V, class C >
+inline typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::own( Node* n )
+{
+    if( !n || n->refs.load( std::memory_order_acquire ) == 1 )
+        return n;
+
+    Node* copy = new Node{ *n };
+    release( n );
+    return copy;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::rotateLeft( Node* h )
+{
+    Node* x = own( h->r );
+    h->r = x->l;
+    x->l = h;
+    x->c = h->c;
+    h->c = RBNode::Red;
+
+    // statistic counting
+    x->s = h->s;
+    h->s = subtreeSize( h->l ) + subtreeSize( h->r ) + 1;
+    return x;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::rotateRight( Node* h )
+{
+    Node* x = own( h->l );
+    h->l = x->r;
+    x->r = h;
+    x->c = h->c;
+    h->c = RBNode::Red;
+
+    // statistic counting
+    x->s = h->s;
+    h->s = subtreeSize( h->l ) + subtreeSize( h->r ) + 1;
+    return x;
+}
+
+template< class K, class V, class C >
+void PersistentOrderStatisticTree< K, V, C >::flipColors( Node* h )
+{
+    h->l = own( h->l );
+    h->r = own( h->r );
+
+    h->c = h->c == RBNode::Red ? RBNode::Black : RBNode::Red;
+    h->l->c = h->l->c == RBNode::Red ? RBNode::Black : RBNode::Red;
+    h->r->c = h->r->c == RBNode::Red ? RBNode::Black : RBNode::Red;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::moveRedLeft( Node* h )
+{
+    flipColors( h );
+    if( isRed( h->r->l ) ) {
+        h->r = rotateRight( h->r );
+        h = rotateLeft( h );
+        flipColors( h );
+    }
+    return h;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::moveRedRight( Node* h )
+{
+    flipColors( h );
+    if( isRed( h->l->l ) ) {
+        h = rotateRight( h );
+        flipColors( h );
+    }
+    return h;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::balance( Node* h )
+{
+    if( isRed( h->r ) && !isRed( h->l ) )    h = rotateLeft( h );
+    if( isRed( h->l ) && isRed( h->l->l ) )  h = rotateRight( h );
+    if( isRed( h->l ) && isRed( h->r ) )     flipColors( h );
+
+    // statistic counting
+    h->s = subtreeSize( h->l ) + subtreeSize( h->r ) + 1;
+    return h;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::deleteMin( Node* h )
+{
+    if( !h->l ) {
+        release( h );
+        return nullptr;
+    }
+
+    h = own( h );
+    if( !isRed( h->l ) && !isRed( h->l->l ) )
+        h = moveRedLeft( h );
+
+    h->l = deleteMin( h->l );
+    return balance( h );
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::insert( Node* h, Node* node )
+{
+    if( !h )
+        return node;
+
+    h = own( h );
+    if( head_.lessThan_( node->key, h->key ) )  h->l = insert( h->l, node );
+    else                                        h->r = insert( h->r, node );
+
+    return balance( h );
+}
+
+// removes by rank rather than by key, which stays unambiguous among duplicate keys
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::remove( Node* h, int order )
+{
+    h = own( h );
+    if( order < subtreeSize( h->l ) ) {
+        if( !isRed( h->l ) && !isRed( h->l->l ) )
+            h = moveRedLeft( h );
+        h->l = remove( h->l, order );
+    }
+    else {
+        if( isRed( h->l ) )
+            h = rotateRight( h );
+
+        if( order == subtreeSize( h->l ) && !h->r ) {
+            release( h );
+            return nullptr;
+        }
+
+        if( !isRed( h->r ) && !isRed( h->r->l ) )
+            h = moveRedRight( h );
+
+        int check = subtreeSize( h->l );
+        if( order == check ) {
+            const Node* min = h->r;
+            while( min->l )
+                min = min->l;
+            h->key = min->key;
+            h->val = min->val;
+            h->r = deleteMin( h->r );
+        }
+        else {
+            h->r = remove( h->r, order - check - 1 );
+        }
+    }
+    return balance( h );
+}
+
+template< class K, class V, class C >
+void PersistentOrderStatisticTree< K, V, C >::insertMulti( const K& key, const V& val )
+{
+    head_.root_ = insert( head_.root_, new Node{ key, val } );
+    head_.root_->c = RBNode::Black;
+}
+
+template< class K, class V, class C >
+void PersistentOrderStatisticTree< K, V, C >::erase( const_iterator i )
+{
+    assert( i != end() );
+
+    Node* root = own( head_.root_ );
+    if( !isRed( root->l ) && !isRed( root->r ) )
+        root->c = RBNode::Red;
+
+    head_.root_ = remove( root, i.order() );
+    if( head_.root_ )
+        head_.root_->c = RBNode::Black;
+}
+
+template< class K, class V, class C >
+bool PersistentOrderStatisticTree< K, V, C >::removeOne( const K& key )
+{
+    const_iterator i = head_.find( key );
+    if( i == end() )
+        return false;
+
+    erase( i );
+    return true;
+}
+
+template< class K, class V, class C >
+void PersistentOrderStatisticTree< K, V, C >::clear()
+{
+    release( head_.root_ );
+    head_.root_ = nullptr;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::const_iterator
+PersistentOrderStatisticTree< K, V, C >::first( const Node* root )
+{
+    const_iterator i;
+    i.pushLeft( root );
+    return i;
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::const_iterator
+PersistentOrderStatisticTree< K, V, C >::find( const Node* root, const K& key,
+                                               const C& lessThan_ )
+{
+    const_iterator i;
+    const Node* n = root;
+    while( n ) {
+        if( lessThan_( key, n->key ) ) {
+            i.path.push_back( n );
+            n = n->l;
+        }
+        else if( lessThan_( n->key, key ) ) {
+            i.o += subtreeSize( n->l ) + 1;
+            n = n->r;
+        }
+        else {
+            i.o += subtreeSize( n->l );
+            i.path.push_back( n );
+            return i;
+        }
+    }
+    return const_iterator{};
+}
+
+template< class K, class V, class C >
+typename PersistentOrderStatisticTree< K, V, C >::const_iterator
+PersistentOrderStatisticTree< K, V, C >::nth( const Node* root, int order )
+{
+    const_iterator i;
+    const Node* n = root;
+    while( n ) {
+        int check = i.o + subtreeSize( n->l );
+        if( order < check ) {
+            i.path.push_back( n );
+            n = n->l;
+        }
+        else if( order > check ) {
+            i.o = check + 1;
+            n = n->r;
+        }
+        else {
+            i.o = check;
+            i.path.push_back( n );
+            return i;
+        }
+    }
+    return const_iterator{};
+}
+
+template< class K, class V, class C >
+const typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::findNode( const Node* root, const K& key,
+                                                   const C& lessThan_ )
+{
+    const Node* n = root;
+    while( n ) {
+        if( lessThan_( key, n->key ) )
+            n = n->l;
+        else if( lessThan_( n->key, key ) )
+            n = n->r;
+        else
+            return n;
+    }
+    return nullptr;
+}
+
+template< class K, class V, class C >
+const typename PersistentOrderStatisticTree< K, V, C >::Node*
+PersistentOrderStatisticTree< K, V, C >::nthNode( const Node* root, int order )
+{
+    const Node* n = root;
+    while( n ) {
+        int check = subtreeSize( n->l );
+        if( order < check )
+            n = n->l;
+        else if( order > check ) {
+            order -= check + 1;
+            n = n->r;
+        }
+        else
+            return n;
+    }
+    return nullptr;
+}
+
+template< class K, class V, class C >
+int PersistentOrderStatisticTree< K, V, C >::countLess( const Node* root, const K& key,
+                                                        const C& lessThan_ )
+{
+    int count = 0;
+    const Node* n = root;
+    while( n ) {
+        if( lessThan_( n->key, key ) ) {
+            count += subtreeSize( n->l ) + 1;
+            n = n->r;
+        }
+        else {
+            n = n->l;
+        }
+    }
+    return count;
+}
+
+#if CHECK_VALID == 0
+#include <assert.h>
+
+template< class K, class V, class C >
+int PersistentOrderStatisticTree< K, V, C >::blackHeight( const Node* n ) const {
+    if( !n )
+        return 0;
+
+    assert( !isRed( n->r ) );
+    assert( !( isRed( n ) && isRed( n->l ) ) );
+    assert( n->s == subtreeSize( n->l ) + subtreeSize( n->r ) + 1 );
+    assert( !n->l || !head_.lessThan_( n->key, n->l->key ) );
+    assert( !n->r || !head_.lessThan_( n->r->key, n->key ) );
+
+    int leftHeight = blackHeight( n->l );
+    int rightHeight = blackHeight( n->r );
+
+    assert( leftHeight == rightHeight );
+    return n->c == RBNode::Black ? leftHeight + 1 : leftHeight;
+}
+
+template< class K, class V, class C >
+bool PersistentOrderStatisticTree< K, V, C >::valid() const
+{
+    if( !head_.root_ )
+        return true;
+
+    assert( head_.root_->c == RBNode::Black );
+    return blackHeight( head_.root_ ) > 0;
+}
+#endif
+
+
+#endif // PERSISTENT_STATISTIC_RB_TREE
@@ -0,0 +1,245 @@
+#ifndef STATISTIC_RB_SEQUENCE
+#define STATISTIC_RB_SEQUENCE
+
+#include <assert.h>
+#include <iterator>
+#include <vector>
+
+#include "statistic_rb_tree.h"
+
+// Keyless indexed sequence, an ordered list with O(log n) access by position.
+//
+// Every operation descends by subtree counts alone, there is no comparator, so inserting,
+// erasing or moving an element never touches unrelated elements.
+template< class V >
+class OrderStatisticSequence : RBTreeData {
+
+    struct Node : RBNode {
+        Node( const V& val )
+            : RBNode{ RBNode::null, RBNode::null, RBNode::null }
+            , val{ val } { }
+        V val;
+    };
+
+    int blackHeight( RBNode* n ) const;
+    void insertNode( int pos, RBNode* node );
+
+    inline static Node* cast( RBNode* node ) { return static_cast< Node* >( node ); }
+
+public:
+    typedef V ValueType;
+
+    class iterator
+    {
+        friend class OrderStatisticSequence;
+
+        Node* i;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::size_t difference_type;
+        typedef V  value_type;
+        typedef V* pointer;
+        typedef V& reference;
+
+        inline iterator() : i{ static_cast< Node* >( RBNode::null ) } { }
+        inline explicit iterator( Node* node ) : i{ node } { }
+
+        inline V& value() const { return i->val; }
+        inline int order() const { return getNodeOrder( i ); }
+
+        inline V& operator * () const { return i->val; }
+        inline V* operator -> () const { return &i->val; }
+        inline bool operator == (iterator o) const { return i == o.i; }
+        inline bool operator != (iterator o) const { return i != o.i; }
+
+        inline iterator &operator ++ ()
+            { i = cast( nextNode( i ) ); return *this; }
+        inline iterator operator ++ (int)
+            { iterator r = *this; i = cast( nextNode( i ) ); return r; }
+
+        inline iterator &operator -- ()
+            { i = cast( prevNode( i ) ); return *this; }
+        inline iterator operator -- (int)
+            { iterator r = *this; i = cast( prevNode( i ) ); return r; }
+    };
+
+    OrderStatisticSequence() { }
+    ~OrderStatisticSequence() { clear(); }
+
+    OrderStatisticSequence( const OrderStatisticSequence& ) = delete;
+    OrderStatisticSequence& operator = ( const OrderStatisticSequence& ) = delete;
+
+    iterator begin() { return iterator{ cast( lowestNode( root_ ) ) }; }
+    iterator end() { return iterator{}; }
+
+    iterator insertAt( int pos, const V& val );
+    template< class It >
+    void insertRange( int pos, It first, It last );
+
+    iterator eraseAt( int pos );
+    iterator move( int from, int to );
+
+    V& at( int pos );
+    iterator getNth( int pos ) { return iterator{ cast( getNodeByOrder( root_, pos ) ) }; }
+
+    inline int size() const { return statisticSize(); }
+
+    void clear();
+
+    bool valid() const;
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+// links node so it ends up at position pos
+template< class V >
+void OrderStatisticSequence< V >::insertNode( int pos, RBNode* node )
+{
+    assert( pos >= 0 && pos <= size() );
+
+    if( root_ == RBNode::null ) {
+        root_ = node;
+    }
+    else {
+        RBNode* p;
+        RBNode* find = root_;
+        while( true ) {
+            p = find;
+            if( pos <= find->l->s ) {
+                find = find->l;
+                if( find == RBNode::null ) {
+                    p->l = node;
+                    break;
+                }
+            }
+            else {
+                pos -= find->l->s + 1;
+                find = find->r;
+                if( find == RBNode::null ) {
+                    p->r = node;
+                    break;
+                }
+            }
+        }
+
+        node->p = p;
+    }
+
+    rebalance( node );
+}
+
+template< class V >
+typename OrderStatisticSequence< V >::iterator
+OrderStatisticSequence< V >::insertAt( int pos, const V& val )
+{
+    Node* node = new Node{ val };
+    insertNode( pos, node );
+    return iterator( node );
+}
+
+template< class V >
+template< class It >
+void OrderStatisticSequence< V >::insertRange( int pos, It first, It last )
+{
+    assert( pos >= 0 && pos <= size() );
+
+    std::vector< RBNode* > nodes;
+    for( ; first != last; ++first )
+        nodes.push_back( new Node{ *first } );
+
+    int count = static_cast< int >( nodes.size() );
+    if( count == 0 )
+        return;
+
+    // a balanced range is black down to its red level
+    int rangeHeight = balancedRedDepth( count );
+    RBNode* range = linkBalanced( nodes.data(), count, 0, rangeHeight );
+
+    RBNode* l;
+    RBNode* r;
+    int lh, rh, mh, h;
+    splitByOrder( root_, rootBlackHeight( root_ ), pos, l, lh, r, rh );
+    RBNode* m = join( l, lh, range, rangeHeight, mh );
+    setRoot( join( m, mh, r, rh, h ) );
+}
+
+template< class V >
+typename OrderStatisticSequence< V >::iterator
+OrderStatisticSequence< V >::eraseAt( int pos )
+{
+    RBNode* n = getNodeByOrder( root_, pos );
+    if( n == RBNode::null )
+        return end();
+
+    iterator next{ cast( nextNode( n ) ) };
+    delete cast( removeNodeAndRebalance( n ) );
+    return next;
+}
+
+// element at from ends up at position to, the node itself is relinked
+template< class V >
+typename OrderStatisticSequence< V >::iterator
+OrderStatisticSequence< V >::move( int from, int to )
+{
+    assert( from >= 0 && from < size() && to >= 0 && to < size() );
+
+    RBNode* n = removeNodeAndRebalance( getNodeByOrder( root_, from ) );
+    n->p = n->l = n->r = RBNode::null;
+    n->c = RBNode::Red;
+    n->s = 1;
+
+    insertNode( to, n );
+    return iterator( cast( n ) );
+}
+
+template< class V >
+inline V& OrderStatisticSequence< V >::at( int pos )
+{
+    assert( pos >= 0 && pos < size() );
+    return cast( getNodeByOrder( root_, pos ) )->val;
+}
+
+template< class V >
+void OrderStatisticSequence< V >::clear()
+{
+    if( root_ != RBNode::null )
+        deleteNodeRecursively( cast( root_ ) );
+
+    root_ = Node::null;
+}
+
+#if CHECK_VALID == 0
+
+template< class V >
+int OrderStatisticSequence< V >::blackHeight( RBNode* n ) const {
+    assert( n != RBNode::null );
+    assert( n->s == n->l->s + n->r->s + 1 );
+    assert( n->l == RBNode::null || n->l->p == n );
+    assert( n->r == RBNode::null || n->r->p == n );
+
+    int leftHeight = n->l != RBNode::null ? blackHeight( n->l ) : 0;
+    int rightHeight = n->r != RBNode::null ? blackHeight( n->r ) : 0;
+
+    assert( leftHeight == rightHeight );
+    return n->c == RBNode::Black ? leftHeight + 1 : leftHeight;
+}
+
+template< class V >
+bool OrderStatisticSequence< V >::valid() const
+{
+    assert( RBNode::null->c == RBNode::Black
+            && RBNode::null->l == RBNode::null->r
+            && RBNode::null->l == RBNode::null->p
+            && RBNode::null->l == RBNode::null );
+
+    if( root_ == RBNode::null )
+        return true;
+
+    assert( root_->p == RBNode::null && root_->c == RBNode::Black );
+    return blackHeight( root_ ) > 0;
+}
+#endif
+
+
+#endif // STATISTIC_RB_SEQUENCE
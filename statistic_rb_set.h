@@ -0,0 +1,339 @@
+#ifndef STATISTIC_RB_SET
+#define STATISTIC_RB_SET
+
+#include <utility>
+
+#include "statistic_rb_tree.h"
+
+// Key only order statistic multiset.
+//
+// Equal keys share one node whose multiplicity is its weight inside the subtree count s,
+// so memory follows the number of distinct keys while ranks still count every copy.
+template< class K, class Comparer = std::less< K > >
+class OrderStatisticMultiset : RBTreeData {
+
+    struct Node : RBNode {
+        Node( const K& key )
+            : RBNode{ RBNode::null, RBNode::null, RBNode::null }
+            , key{ key } { }
+        K key;
+    };
+
+    int blackHeight( RBNode* n ) const;
+    Node* findNode( const K& key ) const;
+
+    inline static Node* cast( RBNode* node ) { return static_cast< Node* >( node ); }
+    inline static int weight( const RBNode* n ) { return n->s - n->l->s - n->r->s; }
+
+    static void addWeight( RBNode* n, int delta );
+
+public:
+    typedef K KeyType;
+
+    // walks every copy of every key
+    class iterator
+    {
+        friend class OrderStatisticMultiset;
+
+        Node* i;
+        int index;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::size_t difference_type;
+        typedef K  value_type;
+        typedef const K* pointer;
+        typedef const K& reference;
+
+        inline iterator() : i{ static_cast< Node* >( RBNode::null ) }, index{ 0 } { }
+        inline iterator( Node* node, int index ) : i{ node }, index{ index } { }
+
+        inline const KeyType& key() const { return i->key; }
+        inline int order() const { return getNodeOrder( i ) + index; }
+        inline int count() const { return weight( i ); }
+
+        inline const KeyType& operator * () const { return i->key; }
+        inline const KeyType* operator -> () const { return &i->key; }
+        inline bool operator == (iterator o) const { return i == o.i && index == o.index; }
+        inline bool operator != (iterator o) const { return !( *this == o ); }
+
+        inline iterator &operator ++ ()
+        {
+            if( ++index == weight( i ) ) {
+                i = cast( nextNode( i ) );
+                index = 0;
+            }
+            return *this;
+        }
+        inline iterator operator ++ (int)
+            { iterator r = *this; ++*this; return r; }
+
+        inline iterator &operator -- ()
+        {
+            if( index-- == 0 ) {
+                i = cast( prevNode( i ) );
+                index = weight( i ) - 1;
+            }
+            return *this;
+        }
+        inline iterator operator -- (int)
+            { iterator r = *this; --*this; return r; }
+    };
+
+    typedef iterator const_iterator;
+
+    explicit OrderStatisticMultiset( const Comparer& comparer = Comparer() )
+        : lessThan_( comparer )
+    { }
+
+    ~OrderStatisticMultiset() { clear(); }
+
+    OrderStatisticMultiset( const OrderStatisticMultiset& ) = delete;
+    OrderStatisticMultiset& operator = ( const OrderStatisticMultiset& ) = delete;
+
+    iterator begin() const { return iterator{ cast( lowestNode( root_ ) ), 0 }; }
+    iterator end() const { return iterator{}; }
+
+    iterator insert( const K& key ) { return insertKey( key, true, nullptr ); }
+    iterator find( const K& key ) const;
+    int count( const K& key ) const;
+
+    bool removeOne( const K& key );
+    int removeMulti( const K& key );
+
+    iterator getNth( int order ) const;
+    int countLess( const K& key ) const;
+
+    inline int size() const { return statisticSize(); }
+
+    void clear();
+
+    bool valid() const;
+
+protected:
+    iterator insertKey( const K& key, bool addCopy, bool* inserted );
+
+private:
+    Comparer lessThan_;
+};
+
+// Key only order statistic set, a multiset that never adds a second copy.
+template< class K, class Comparer = std::less< K > >
+class OrderStatisticSet : OrderStatisticMultiset< K, Comparer > {
+
+    typedef OrderStatisticMultiset< K, Comparer > Base;
+
+public:
+    typedef typename Base::KeyType KeyType;
+    typedef typename Base::iterator iterator;
+    typedef typename Base::const_iterator const_iterator;
+
+    explicit OrderStatisticSet( const Comparer& comparer = Comparer() )
+        : Base( comparer )
+    { }
+
+    using Base::begin;
+    using Base::end;
+    using Base::find;
+    using Base::count;
+    using Base::getNth;
+    using Base::countLess;
+    using Base::size;
+    using Base::removeOne;
+    using Base::clear;
+    using Base::valid;
+
+    std::pair< iterator, bool > insert( const K& key )
+    {
+        bool inserted;
+        iterator i = Base::insertKey( key, false, &inserted );
+        return std::make_pair( i, inserted );
+    }
+};
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+template< class K, class C >
+void OrderStatisticMultiset< K, C >::addWeight( RBNode* n, int delta )
+{
+    for( ; n != RBNode::null; n = n->p )
+        n->s += delta;
+}
+
+template< class K, class C >
+typename OrderStatisticMultiset< K, C >::iterator
+OrderStatisticMultiset< K, C >::insertKey( const K& key, bool addCopy, bool* inserted )
+{
+    RBNode* p = RBNode::null;
+    RBNode* find = root_;
+    bool left = false;
+    while( find != RBNode::null ) {
+        p = find;
+        if( lessThan_( key, cast( find )->key ) ) {
+            find = find->l;
+            left = true;
+        }
+        else if( lessThan_( cast( find )->key, key ) ) {
+            find = find->r;
+            left = false;
+        }
+        else {
+            if( inserted )
+                *inserted = addCopy;
+            if( !addCopy )
+                return iterator{ cast( find ), 0 };
+
+            addWeight( find, 1 );
+            return iterator{ cast( find ), weight( find ) - 1 };
+        }
+    }
+
+    Node* node = new Node{ key };
+    if( p == RBNode::null )     root_ = node;
+    else if( left )             p->l = node;
+    else                        p->r = node;
+    node->p = p;
+
+    rebalance( node );
+
+    if( inserted )
+        *inserted = true;
+    return iterator{ node, 0 };
+}
+
+template< class K, class C >
+typename OrderStatisticMultiset< K, C >::Node*
+OrderStatisticMultiset< K, C >::findNode( const K& key ) const
+{
+    RBNode* n = root_;
+    while( n != RBNode::null ) {
+        if( lessThan_( key, cast( n )->key ) )       { n = n->l; }
+        else if( lessThan_( cast( n )->key, key ) )  { n = n->r; }
+        else                                         break;
+    }
+
+    return cast( n );
+}
+
+template< class K, class C >
+inline typename OrderStatisticMultiset< K, C >::iterator
+OrderStatisticMultiset< K, C >::find( const K& key ) const
+{
+    return iterator{ findNode( key ), 0 };
+}
+
+template< class K, class C >
+inline int OrderStatisticMultiset< K, C >::count( const K& key ) const
+{
+    return weight( findNode( key ) );
+}
+
+template< class K, class C >
+bool OrderStatisticMultiset< K, C >::removeOne( const K& key )
+{
+    Node* find = findNode( key );
+    if( find == RBNode::null )
+        return false;
+
+    if( weight( find ) > 1 )
+        addWeight( find, -1 );
+    else
+        delete cast( removeNodeAndRebalance( find ) );
+
+    return true;
+}
+
+template< class K, class C >
+int OrderStatisticMultiset< K, C >::removeMulti( const K& key )
+{
+    Node* find = findNode( key );
+    if( find == RBNode::null )
+        return 0;
+
+    int removed = weight( find );
+    delete cast( removeNodeAndRebalance( find ) );
+
+    return removed;
+}
+
+template< class K, class C >
+typename OrderStatisticMultiset< K, C >::iterator
+OrderStatisticMultiset< K, C >::getNth( int order ) const
+{
+    RBNode* find = getNodeByOrder( root_, order );
+    if( find == RBNode::null )
+        return end();
+
+    return iterator{ cast( find ), order - getNodeOrder( find ) };
+}
+
+template< class K, class C >
+int OrderStatisticMultiset< K, C >::countLess( const K& key ) const
+{
+    int count = 0;
+    RBNode* n = root_;
+    while( n != RBNode::null ) {
+        if( lessThan_( cast( n )->key, key ) ) {
+            count += n->s - n->r->s;
+            n = n->r;
+        }
+        else {
+            n = n->l;
+        }
+    }
+    return count;
+}
+
+template< class K, class C >
+void OrderStatisticMultiset< K, C >::clear()
+{
+    if( root_ != RBNode::null )
+        deleteNodeRecursively( cast( root_ ) );
+
+    root_ = Node::null;
+}
+
+#if CHECK_VALID == 0
+#include <assert.h>
+
+template< class K, class C >
+int OrderStatisticMultiset< K, C >::blackHeight( RBNode* n ) const {
+    assert( n != RBNode::null );
+    assert( weight( n ) > 0 );
+
+    Node* l = cast( n->l );
+    Node* r = cast( n->r );
+
+    int leftHeight = 0;
+    int rightHeight = 0;
+    if( l != RBNode::null ) {
+        leftHeight += blackHeight( l );
+        assert( lessThan_( l->key, cast( n )->key ) );
+    }
+
+    if( r != RBNode::null ) {
+        rightHeight += blackHeight( r );
+        assert( lessThan_( cast( n )->key, r->key ) );
+    }
+
+    assert( leftHeight == rightHeight );
+    return n->c == RBNode::Black ? leftHeight + 1 : leftHeight;
+}
+
+template< class K, class C >
+bool OrderStatisticMultiset< K, C >::valid() const
+{
+    assert( RBNode::null->c == RBNode::Black
+            && RBNode::null->l == RBNode::null->r
+            && RBNode::null->l == RBNode::null->p
+            && RBNode::null->l == RBNode::null );
+
+    if( root_ == RBNode::null )
+        return true;
+
+    return blackHeight( root_ ) > 0;
+}
+#endif
+
+
+#endif // STATISTIC_RB_SET
@@ -58,15 +58,17 @@ RBNode* lowestNode( RBNode* node)
 
 RBNode* getNodeByOrder( RBNode* root, int order )
 {
+    // a node covers the orders [check, check + weight)
     RBNode* find = root;
     int current = 0;
     while( find != RBNode::null ) {
         int check = current + find->l->s;
+        int weight = find->s - find->l->s - find->r->s;
         if( order < check ) {
             find = find->l;
         }
-        else if( order > check ) {
-            current = check + 1;
+        else if( order >= check + weight ) {
+            current = check + weight;
             find = find->r;
         }
         else {
@@ -84,7 +86,7 @@ int getNodeOrder( RBNode* node )
     int order = 0;
     while( p != RBNode::null ) {
         if( find == p->r ) {
-            order += p->l->s + 1;
+            order += p->s - find->s;
         }
         find = p;
         p = p->p;
@@ -94,25 +96,23 @@ int getNodeOrder( RBNode* node )
 
 RBNode* getDistanceNode( RBNode* node, int distance )
 {
-    RBNode* find = node;
-    RBNode* p = node->p;
-    int order = 0;
-    while( p != RBNode::null ) {
-        if( find == p->r ) {
-            order = p->s + 1;
-        }
-        find = p;
-        p = p->p;
-    }
+    RBNode* root = node;
+    while( root->p != RBNode::null )
+        root = root->p;
 
-    // now find is root node
-    order = order + node->l->s + distance;
-    return getNodeByOrder( find, order );
+    // distance counts from the first order the node covers
+    return getNodeByOrder( root, getNodeOrder( node ) + distance );
 }
 
 void RBTreeData::rotateLeft(RBNode* n)
 {
     RBNode* r = n->r;
+
+    // statistic counting, works on totals so node weights need not be 1
+    int total = n->s;
+    n->s = total - r->s + r->l->s;
+    r->s = total;
+
     n->r = r->l;
     if( r->l != RBNode::null )
         r->l->p = n;
@@ -125,16 +125,18 @@ void RBTreeData::rotateLeft(RBNode* n)
 
     r->l = n;
     n->p = r;
-
-    // statistic counting
-    n->s = n->l->s + n->r->s + 1;
-    r->s = r->l->s + r->r->s + 1;
 }
 
 
 void RBTreeData::rotateRight(RBNode* n)
 {
     RBNode* l = n->l;
+
+    // statistic counting
+    int total = n->s;
+    n->s = total - l->s + l->r->s;
+    l->s = total;
+
     n->l = l->r;
     if( l->r != RBNode::null )
         l->r->p = n;
@@ -147,17 +149,18 @@ void RBTreeData::rotateRight(RBNode* n)
 
     l->r = n;
     n->p = l;
-
-    // statistic counting
-    n->s = n->l->s + n->r->s + 1;
-    l->s = l->l->s + l->r->s + 1;
 }
 
 void RBTreeData::rebalance(RBNode* n)
 {
     // statistic counting
-    for( RBNode* p = n->p; p != RBNode::null; ++p->s, p = p->p ){ };
+    for( RBNode* p = n->p; p != RBNode::null; p->s += n->s, p = p->p ){ };
+
+    fixInsertion( n );
+}
 
+bool RBTreeData::fixInsertion(RBNode* n)
+{
     while( n != root_ && n->p->c == RBNode::Red ) {
         if( n->p == n->p->p->l ) {
             RBNode* u = n->p->p->r;
@@ -193,7 +196,10 @@ void RBTreeData::rebalance(RBNode* n)
             }
         }
     }
+    // the red reached the root, blackening it adds a level
+    bool grown = root_->c == RBNode::Red;
     root_->c = RBNode::Black;
+    return grown;
 }
 
 RBNode* RBTreeData::removeNodeAndRebalance(RBNode* n)
@@ -202,6 +208,9 @@ RBNode* RBTreeData::removeNodeAndRebalance(RBNode* n)
     RBNode* old = n;
     RBNode *to;
     RBNode *to_parent;
+    RBNode *moved = RBNode::null;
+    int weight = n->s - n->l->s - n->r->s;
+    int lost = weight;
 
     if( old->l == RBNode::null ) {
         to = old->r;
@@ -215,6 +224,8 @@ RBNode* RBTreeData::removeNodeAndRebalance(RBNode* n)
             while( old->l != RBNode::null )
                 old = old->l;
             to = old->r;
+            moved = old;
+            lost = old->s - to->s;
         }
     }
 
@@ -252,8 +263,16 @@ RBNode* RBTreeData::removeNodeAndRebalance(RBNode* n)
         else                    n->p->r = to;
     }
 
-    // statistic counting
-    for( RBNode* p = to_parent; p != RBNode::null; p->s = p->l->s + p->r->s + 1, p = p->p ){ };
+    // statistic counting, nodes below the moved successor lost its weight, nodes above lost n
+    for( RBNode* p = to_parent; p != RBNode::null; p = p->p ) {
+        if( p == moved ) {
+            p->s = p->l->s + p->r->s + lost;
+            lost = weight;
+        }
+        else {
+            p->s -= lost;
+        }
+    }
 
     // recolor
     if( old->c == RBNode::Black ) {
@@ -327,6 +346,180 @@ RBNode* RBTreeData::removeNodeAndRebalance(RBNode* n)
     return old;
 }
 
+int RBTreeData::rootBlackHeight( RBNode* root )
+{
+    if( root == RBNode::null )
+        return 0;
+
+    int height = 1;
+    for( RBNode* n = root->l; n != RBNode::null; n = n->l ) {
+        if( n->c == RBNode::Black )
+            ++height;
+    }
+    return height;
+}
+
+RBNode* RBTreeData::join( RBNode* l, int lh, RBNode* k, RBNode* r, int rh, int& h )
+{
+    // black roots keep both parts valid trees
+    if( l != RBNode::null ) {
+        l->p = RBNode::null;
+        l->c = RBNode::Black;
+    }
+    if( r != RBNode::null ) {
+        r->p = RBNode::null;
+        r->c = RBNode::Black;
+    }
+
+    int weight = k->s;
+
+    if( lh == rh ) {
+        k->p = RBNode::null;
+        k->l = l;
+        k->r = r;
+        if( l != RBNode::null ) l->p = k;
+        if( r != RBNode::null ) r->p = k;
+        k->c = RBNode::Black;
+        k->s = l->s + r->s + weight;
+        h = lh + 1;
+        return k;
+    }
+
+    // black node c on the facing spine of the higher tree with black height of the other,
+    // c may be null so its parent is tracked separately
+    RBTreeData t;
+    RBNode* c;
+    RBNode* p = RBNode::null;
+    if( lh > rh ) {
+        t.root_ = l;
+        c = l;
+        for( int ch = lh; c->c == RBNode::Red || ch > rh; p = c, c = c->r ) {
+            if( c->c == RBNode::Black )
+                --ch;
+        }
+        p->r = k;
+        k->l = c;
+        k->r = r;
+    }
+    else {
+        t.root_ = r;
+        c = r;
+        for( int ch = rh; c->c == RBNode::Red || ch > lh; p = c, c = c->l ) {
+            if( c->c == RBNode::Black )
+                --ch;
+        }
+        p->l = k;
+        k->l = l;
+        k->r = c;
+    }
+    k->p = p;
+
+    if( k->l != RBNode::null ) k->l->p = k;
+    if( k->r != RBNode::null ) k->r->p = k;
+    k->c = RBNode::Red;
+
+    // statistic counting
+    k->s = k->l->s + k->r->s + weight;
+    int added = ( lh > rh ? r->s : l->s ) + weight;
+    for( ; p != RBNode::null; p->s += added, p = p->p ){ };
+
+    h = std::max( lh, rh ) + ( t.fixInsertion( k ) ? 1 : 0 );
+    return t.root_;
+}
+
+RBNode* RBTreeData::join( RBNode* l, int lh, RBNode* r, int rh, int& h )
+{
+    if( l == RBNode::null ) {
+        h = rh;
+        return r;
+    }
+    if( r == RBNode::null ) {
+        h = lh;
+        return l;
+    }
+
+    // detach the last node of l as the middle key
+    RBNode* max = l;
+    while( max->r != RBNode::null )
+        max = max->r;
+
+    RBNode* rest;
+    RBNode* last;
+    int resth;
+    int lasth;
+    split( l, lh, [max]( RBNode* x ) { return x != max; }, rest, resth, last, lasth );
+
+    return join( rest, resth, max, r, rh, h );
+}
+
+void RBTreeData::splitByOrder( RBNode* n, int h, int order,
+                               RBNode*& l, int& lh, RBNode*& r, int& rh )
+{
+    if( n == RBNode::null ) {
+        l = r = RBNode::null;
+        lh = rh = 0;
+        return;
+    }
+
+    RBNode* nl = n->l;
+    RBNode* nr = n->r;
+    int nlh = childBlackHeight( nl, h );
+    int nrh = childBlackHeight( nr, h );
+    n->s -= nl->s + nr->s;
+
+    RBNode* m;
+    int mh;
+    if( nl->s < order ) {
+        splitByOrder( nr, nrh, order - nl->s - n->s, m, mh, r, rh );
+        l = join( nl, nlh, n, m, mh, lh );
+    }
+    else {
+        splitByOrder( nl, nlh, order, l, lh, m, mh );
+        r = join( m, mh, n, nr, nrh, rh );
+    }
+}
+
+void RBTreeData::setRoot( RBNode* root )
+{
+    root_ = root;
+    if( root_ != RBNode::null ) {
+        root_->p = RBNode::null;
+        root_->c = RBNode::Black;
+    }
+}
+
+int RBTreeData::balancedRedDepth( int count )
+{
+    // levels above are complete, the last partial level is colored red
+    int depth = 0;
+    while( ( 2 << depth ) - 1 <= count )
+        ++depth;
+    return depth;
+}
+
+RBNode* RBTreeData::linkNode( RBNode* n, RBNode* l, RBNode* r, int depth, int redDepth )
+{
+    n->p = RBNode::null;
+    n->l = l;
+    n->r = r;
+    if( l != RBNode::null ) l->p = n;
+    if( r != RBNode::null ) r->p = n;
+    n->c = depth == redDepth ? RBNode::Red : RBNode::Black;
+    n->s = l->s + r->s + 1;
+    return n;
+}
+
+RBNode* RBTreeData::linkBalanced( RBNode** nodes, int count, int depth, int redDepth )
+{
+    if( count == 0 )
+        return RBNode::null;
+
+    int mid = count / 2;
+    RBNode* l = linkBalanced( nodes, mid, depth + 1, redDepth );
+    RBNode* r = linkBalanced( nodes + mid + 1, count - mid - 1, depth + 1, redDepth );
+    return linkNode( nodes[ mid ], l, r, depth, redDepth );
+}
+
 int RBTreeData::statisticSize() const
 {
     return root_->s;
@@ -1,7 +1,13 @@
 #ifndef STATIC_RB_TREE
 #define STATIC_RB_TREE
 
+#include <assert.h>
+#include <algorithm>
+#include <atomic>
 #include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
 
 struct RBNode {
     RBNode* p;
@@ -10,6 +16,7 @@ struct RBNode {
 
     enum Color { Red, Black	} c;
 
+    // entries in subtree, a node's own weight is s - l->s - r->s and may exceed 1
     int s;
 
     static RBNode* null;
@@ -30,19 +37,85 @@ int getNodeOrder( RBNode* node );
 
 RBNode* getDistanceNode( RBNode* node, int distance );
 
+// Runs task( i ) for every i in [0, tasks) on a pool of threads. Tasks are claimed one by one
+// from a shared counter, so workers that finish early keep pulling the remaining ones.
+template< class Task >
+void runTasks( int tasks, Task task, int threads = 0 )
+{
+    if( threads <= 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+    threads = std::min( threads, tasks );
+
+    std::atomic< int > next{ 0 };
+    auto worker = [&]() {
+        for( int i = next++; i < tasks; i = next++ )
+            task( i );
+    };
+
+    std::vector< std::thread > pool;
+    for( int t = 1; t < threads; ++t )
+        pool.emplace_back( worker );
+    worker();
+    for( std::thread& t : pool )
+        t.join();
+}
+
+
+template< class K, class C >
+class OrderStatisticMultiset;
+
+template< class V >
+class OrderStatisticSequence;
 
 class RBTreeData {
 
     template< class K, class V, class C >
     friend class OrderStatisticTree;
 
+    template< class K, class C >
+    friend class OrderStatisticMultiset;
+
+    template< class V >
+    friend class OrderStatisticSequence;
+
     RBTreeData();
 
     void rotateLeft(RBNode* n);
     void rotateRight(RBNode* n);
     void rebalance(RBNode* n);
+    // returns whether the black height grew
+    bool fixInsertion(RBNode* n);
     RBNode *removeNodeAndRebalance(RBNode* n);
 
+    // join trees l < k < r into one, k->s holds weight of the detached k. Heights are black
+    // heights with the root counted black, lh and rh those of l and r, h receives the
+    // height of the result. Costs O(|lh - rh|), join of l and r without k O(lh).
+    static RBNode* join( RBNode* l, int lh, RBNode* k, RBNode* r, int rh, int& h );
+    static RBNode* join( RBNode* l, int lh, RBNode* r, int rh, int& h );
+
+    // split tree of black height h into nodes for which goesLeft holds, which must be an in
+    // order prefix, and the rest. Joins along the path telescope, so it costs O(log n).
+    template< class GoesLeft >
+    static void split( RBNode* n, int h, GoesLeft goesLeft,
+                       RBNode*& l, int& lh, RBNode*& r, int& rh );
+
+    // split tree of black height h into its first order entries and the rest
+    static void splitByOrder( RBNode* n, int h, int order,
+                              RBNode*& l, int& lh, RBNode*& r, int& rh );
+
+    // black height of a tree as join expects it, walks one spine
+    static int rootBlackHeight( RBNode* root );
+    // black height of child c of a node with black height h, once c is made a root
+    inline static int childBlackHeight( RBNode* c, int h )
+        { return c->c == RBNode::Red ? h : h - 1; }
+
+    void setRoot( RBNode* root );
+
+    // links sorted nodes into a perfectly balanced tree, nodes at redDepth are red
+    static RBNode* linkBalanced( RBNode** nodes, int count, int depth, int redDepth );
+    static RBNode* linkNode( RBNode* n, RBNode* l, RBNode* r, int depth, int redDepth );
+    static int balancedRedDepth( int count );
+
     int getStatistic( RBNode* node );
 
     int statisticSize() const;
@@ -50,6 +123,34 @@ class RBTreeData {
     RBNode* root_;
 };
 
+template< class GoesLeft >
+void RBTreeData::split( RBNode* n, int h, GoesLeft goesLeft,
+                        RBNode*& l, int& lh, RBNode*& r, int& rh )
+{
+    if( n == RBNode::null ) {
+        l = r = RBNode::null;
+        lh = rh = 0;
+        return;
+    }
+
+    RBNode* nl = n->l;
+    RBNode* nr = n->r;
+    int nlh = childBlackHeight( nl, h );
+    int nrh = childBlackHeight( nr, h );
+    n->s -= nl->s + nr->s;
+
+    RBNode* m;
+    int mh;
+    if( goesLeft( n ) ) {
+        split( nr, nrh, goesLeft, m, mh, r, rh );
+        l = join( nl, nlh, n, m, mh, lh );
+    }
+    else {
+        split( nl, nlh, goesLeft, l, lh, m, mh );
+        r = join( m, mh, n, nr, nrh, rh );
+    }
+}
+
 template< class K, class V, class Comparer = std::less< K > >
 class OrderStatisticTree : RBTreeData {
 
@@ -64,6 +165,17 @@ class OrderStatisticTree : RBTreeData {
     int blackHeight( RBNode* n ) const;
     Node* findNode( Node* find, const K& key );
 
+    // black heights travel with the trees, see join
+    void splitByKey( RBNode* n, int h, const K& key, RBNode*& less, int& lessHeight,
+                     RBNode*& equal, int& equalHeight, RBNode*& greater, int& greaterHeight );
+    RBNode* mergeNodes( RBNode* a, int ah, RBNode* b, int bh, int& h );
+    RBNode* unionNodes( RBNode* a, int ah, RBNode* b, int bh, int& h );
+    RBNode* intersectNodes( RBNode* a, int ah, const RBNode* b, int& h );
+    RBNode* differenceNodes( RBNode* a, int ah, const RBNode* b, int& h );
+
+    static RBNode* linkParallel( RBNode** nodes, int count, int depth, int redDepth,
+                                 int threads );
+
     inline static Node* cast( RBNode* node ) { return static_cast< Node* >( node ); }
 
 public:
@@ -177,11 +289,34 @@ public:
     int removeMulti( const K& key );
 
     iterator getNth( int order );
+    int countLess( const K& key ) const;
 
     inline int size() const { return statisticSize(); }
 
     void clear();
 
+    // replaces content with items, equal keys keep input order. items are sorted in place,
+    // pass std::move( items ) or a copy to keep the original. Runs of items are sorted in
+    // parallel, then merged pairwise in rounds, each round on freshly started threads. The
+    // last round is one inplace_merge over all items on a single thread, so the sort keeps
+    // an O(n) serial tail. Nodes are allocated and linked on at most threads threads.
+    void bulkBuild( std::vector< std::pair< K, V > >&& items, int threads = 0 );
+
+    // f( key, value ) / map( key, value ) over orders [first, last) clamped to [0, size()),
+    // split into equal rank chunks. init must be the identity of reduce, chunks are reduced
+    // in order.
+    template< class F >
+    void parallelForEach( int first, int last, F f, int threads = 0 );
+    template< class T, class Map, class Reduce >
+    T parallelReduce( int first, int last, T init, Map map, Reduce reduce, int threads = 0 );
+
+    // set algebra, each costs O(m log(n/m + 1)) for m nodes in other and n in this tree.
+    // merge and unionWith move nodes out of other and leave it empty, other must not be this tree.
+    void merge( OrderStatisticTree& other );
+    void unionWith( OrderStatisticTree& other );
+    void intersect( const OrderStatisticTree& other );
+    void difference( const OrderStatisticTree& other );
+
     bool valid() const;
 
 private:
@@ -292,6 +427,23 @@ OrderStatisticTree< K, V, C >::getNth( int order )
     return iterator{ cast( getNodeByOrder( root_, order ) ) };
 }
 
+template< class K, class V, class C >
+int OrderStatisticTree< K, V, C >::countLess( const K& key ) const
+{
+    int count = 0;
+    RBNode* n = root_;
+    while( n != RBNode::null ) {
+        if( lessThan_( cast( n )->key, key ) ) {
+            count += n->l->s + 1;
+            n = n->r;
+        }
+        else {
+            n = n->l;
+        }
+    }
+    return count;
+}
+
 template< class NodeType >
 void deleteNodeRecursively( NodeType* node ) {
     if( node->l != RBNode::null )
@@ -312,6 +464,315 @@ void OrderStatisticTree< K, V, C >::clear()
     root_ = Node::null;
 }
 
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::splitByKey( RBNode* n, int h, const K& key,
+                                                RBNode*& less, int& lessHeight,
+                                                RBNode*& equal, int& equalHeight,
+                                                RBNode*& greater, int& greaterHeight )
+{
+    RBNode* rest;
+    int restHeight;
+    split( n, h, [&]( RBNode* x ) { return lessThan_( cast( x )->key, key ); },
+           less, lessHeight, rest, restHeight );
+    split( rest, restHeight, [&]( RBNode* x ) { return !lessThan_( key, cast( x )->key ); },
+           equal, equalHeight, greater, greaterHeight );
+}
+
+// nodes of b go after equal keys of a, as insertMulti would place them
+template< class K, class V, class C >
+RBNode* OrderStatisticTree< K, V, C >::mergeNodes( RBNode* a, int ah, RBNode* b, int bh, int& h )
+{
+    if( b == RBNode::null ) {
+        h = ah;
+        return a;
+    }
+    if( a == RBNode::null ) {
+        h = bh;
+        return b;
+    }
+
+    RBNode* bl = b->l;
+    RBNode* br = b->r;
+    int blh = childBlackHeight( bl, bh );
+    int brh = childBlackHeight( br, bh );
+    b->s -= bl->s + br->s;
+
+    const K& key = cast( b )->key;
+    RBNode* al;
+    RBNode* ar;
+    int alh, arh;
+    split( a, ah, [&]( RBNode* x ) { return !lessThan_( key, cast( x )->key ); },
+           al, alh, ar, arh );
+
+    int lh, rh;
+    RBNode* l = mergeNodes( al, alh, bl, blh, lh );
+    RBNode* r = mergeNodes( ar, arh, br, brh, rh );
+    return join( l, lh, b, r, rh, h );
+}
+
+template< class K, class V, class C >
+RBNode* OrderStatisticTree< K, V, C >::unionNodes( RBNode* a, int ah, RBNode* b, int bh, int& h )
+{
+    if( b == RBNode::null ) {
+        h = ah;
+        return a;
+    }
+    if( a == RBNode::null ) {
+        h = bh;
+        return b;
+    }
+
+    RBNode* bl = b->l;
+    RBNode* br = b->r;
+    int blh = childBlackHeight( bl, bh );
+    int brh = childBlackHeight( br, bh );
+    b->s -= bl->s + br->s;
+
+    RBNode* al;
+    RBNode* am;
+    RBNode* ar;
+    int alh, amh, arh;
+    splitByKey( a, ah, cast( b )->key, al, alh, am, amh, ar, arh );
+
+    int lh, rh;
+    if( am == RBNode::null ) {
+        RBNode* l = unionNodes( al, alh, bl, blh, lh );
+        RBNode* r = unionNodes( ar, arh, br, brh, rh );
+        return join( l, lh, b, r, rh, h );
+    }
+
+    // key is already present, drop every copy of it coming from b
+    const K& key = cast( b )->key;
+    RBNode* dropped;
+    int droppedHeight;
+    split( bl, blh, [&]( RBNode* x ) { return lessThan_( cast( x )->key, key ); },
+           bl, blh, dropped, droppedHeight );
+    if( dropped != RBNode::null )
+        deleteNodeRecursively( cast( dropped ) );
+
+    split( br, brh, [&]( RBNode* x ) { return !lessThan_( key, cast( x )->key ); },
+           dropped, droppedHeight, br, brh );
+    if( dropped != RBNode::null )
+        deleteNodeRecursively( cast( dropped ) );
+
+    delete cast( b );
+
+    int mh;
+    RBNode* l = unionNodes( al, alh, bl, blh, lh );
+    RBNode* r = unionNodes( ar, arh, br, brh, rh );
+    RBNode* m = join( l, lh, am, amh, mh );
+    return join( m, mh, r, rh, h );
+}
+
+template< class K, class V, class C >
+RBNode* OrderStatisticTree< K, V, C >::intersectNodes( RBNode* a, int ah, const RBNode* b, int& h )
+{
+    if( a == RBNode::null ) {
+        h = 0;
+        return a;
+    }
+    if( b == RBNode::null ) {
+        deleteNodeRecursively( cast( a ) );
+        h = 0;
+        return RBNode::null;
+    }
+
+    RBNode* al;
+    RBNode* am;
+    RBNode* ar;
+    int alh, amh, arh;
+    splitByKey( a, ah, static_cast< const Node* >( b )->key, al, alh, am, amh, ar, arh );
+
+    int lh, rh, mh;
+    RBNode* l = intersectNodes( al, alh, b->l, lh );
+    RBNode* r = intersectNodes( ar, arh, b->r, rh );
+    RBNode* m = join( l, lh, am, amh, mh );
+    return join( m, mh, r, rh, h );
+}
+
+template< class K, class V, class C >
+RBNode* OrderStatisticTree< K, V, C >::differenceNodes( RBNode* a, int ah, const RBNode* b, int& h )
+{
+    if( a == RBNode::null || b == RBNode::null ) {
+        h = ah;
+        return a;
+    }
+
+    RBNode* al;
+    RBNode* am;
+    RBNode* ar;
+    int alh, amh, arh;
+    splitByKey( a, ah, static_cast< const Node* >( b )->key, al, alh, am, amh, ar, arh );
+
+    if( am != RBNode::null )
+        deleteNodeRecursively( cast( am ) );
+
+    int lh, rh;
+    RBNode* l = differenceNodes( al, alh, b->l, lh );
+    RBNode* r = differenceNodes( ar, arh, b->r, rh );
+    return join( l, lh, r, rh, h );
+}
+
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::merge( OrderStatisticTree& other )
+{
+    // splitting this tree would tear apart the other one too
+    assert( &other != this );
+
+    int h;
+    setRoot( mergeNodes( root_, rootBlackHeight( root_ ),
+                         other.root_, rootBlackHeight( other.root_ ), h ) );
+    other.root_ = RBNode::null;
+}
+
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::unionWith( OrderStatisticTree& other )
+{
+    assert( &other != this );
+
+    int h;
+    setRoot( unionNodes( root_, rootBlackHeight( root_ ),
+                         other.root_, rootBlackHeight( other.root_ ), h ) );
+    other.root_ = RBNode::null;
+}
+
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::intersect( const OrderStatisticTree& other )
+{
+    assert( &other != this );
+
+    int h;
+    setRoot( intersectNodes( root_, rootBlackHeight( root_ ), other.root_, h ) );
+}
+
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::difference( const OrderStatisticTree& other )
+{
+    assert( &other != this );
+
+    int h;
+    setRoot( differenceNodes( root_, rootBlackHeight( root_ ), other.root_, h ) );
+}
+
+template< class K, class V, class C >
+RBNode* OrderStatisticTree< K, V, C >::linkParallel( RBNode** nodes, int count, int depth,
+                                                     int redDepth, int threads )
+{
+    if( threads < 2 || count < 2 )
+        return linkBalanced( nodes, count, depth, redDepth );
+
+    // the threads are split between both halves, so no more than threads run at once
+    int mid = count / 2;
+    int leftThreads = threads / 2;
+    RBNode* l;
+    std::thread left( [&]() { l = linkParallel( nodes, mid, depth + 1, redDepth, leftThreads ); } );
+    RBNode* r = linkParallel( nodes + mid + 1, count - mid - 1, depth + 1, redDepth,
+                              threads - leftThreads );
+    left.join();
+
+    return linkNode( nodes[ mid ], l, r, depth, redDepth );
+}
+
+template< class K, class V, class C >
+void OrderStatisticTree< K, V, C >::bulkBuild( std::vector< std::pair< K, V > >&& items,
+                                               int threads )
+{
+    clear();
+
+    if( threads <= 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    int count = static_cast< int >( items.size() );
+    if( count == 0 )
+        return;
+
+    auto less = [this]( const std::pair< K, V >& a, const std::pair< K, V >& b ) {
+        return lessThan_( a.first, b.first );
+    };
+
+    // sort runs in parallel, then merge neighbour runs pairwise until one is left
+    int runs = std::min( threads, count );
+    auto runBegin = [&]( int i ) { return items.begin() + static_cast< long long >( count ) * i / runs; };
+
+    runTasks( runs, [&]( int i ) { std::stable_sort( runBegin( i ), runBegin( i + 1 ), less ); },
+              threads );
+
+    for( int width = 1; width < runs; width *= 2 ) {
+        int merges = ( runs + 2 * width - 1 ) / ( 2 * width );
+        runTasks( merges, [&]( int i ) {
+            int lo = 2 * width * i;
+            int mid = std::min( lo + width, runs );
+            int hi = std::min( lo + 2 * width, runs );
+            std::inplace_merge( runBegin( lo ), runBegin( mid ), runBegin( hi ), less );
+        }, threads );
+    }
+
+    std::vector< RBNode* > nodes( count );
+    int chunks = std::min( threads * 8, count );
+    runTasks( chunks, [&]( int i ) {
+        int end = static_cast< long long >( count ) * ( i + 1 ) / chunks;
+        for( int j = static_cast< long long >( count ) * i / chunks; j < end; ++j )
+            nodes[ j ] = new Node{ items[ j ].first, items[ j ].second };
+    }, threads );
+
+    setRoot( linkParallel( nodes.data(), count, 0, balancedRedDepth( count ), threads ) );
+}
+
+template< class K, class V, class C >
+template< class F >
+void OrderStatisticTree< K, V, C >::parallelForEach( int first, int last, F f, int threads )
+{
+    if( threads <= 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    first = std::max( first, 0 );
+    last = std::min( last, size() );
+    int count = last - first;
+    if( count <= 0 )
+        return;
+
+    int chunks = std::min( threads * 8, count );
+    runTasks( chunks, [&]( int i ) {
+        int begin = first + static_cast< long long >( count ) * i / chunks;
+        int end = first + static_cast< long long >( count ) * ( i + 1 ) / chunks;
+        RBNode* n = getNodeByOrder( root_, begin );
+        for( int order = begin; order < end; ++order, n = nextNode( n ) )
+            f( cast( n )->key, cast( n )->val );
+    }, threads );
+}
+
+template< class K, class V, class C >
+template< class T, class Map, class Reduce >
+T OrderStatisticTree< K, V, C >::parallelReduce( int first, int last, T init, Map map,
+                                                 Reduce reduce, int threads )
+{
+    if( threads <= 0 )
+        threads = std::max( 1u, std::thread::hardware_concurrency() );
+
+    first = std::max( first, 0 );
+    last = std::min( last, size() );
+    int count = last - first;
+    if( count <= 0 )
+        return init;
+
+    int chunks = std::min( threads * 8, count );
+    std::vector< T > partial( chunks, init );
+    runTasks( chunks, [&]( int i ) {
+        int begin = first + static_cast< long long >( count ) * i / chunks;
+        int end = first + static_cast< long long >( count ) * ( i + 1 ) / chunks;
+        RBNode* n = getNodeByOrder( root_, begin );
+        T acc = init;
+        for( int order = begin; order < end; ++order, n = nextNode( n ) )
+            acc = reduce( acc, map( cast( n )->key, cast( n )->val ) );
+        partial[ i ] = acc;
+    }, threads );
+
+    T result = init;
+    for( const T& value : partial )
+        result = reduce( result, value );
+    return result;
+}
+
 #if CHECK_VALID == 0
 #include <assert.h>
 